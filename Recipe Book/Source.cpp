@@ -1,76 +1,323 @@
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <array>
 #include <string>
+#include <string_view>
 #include <map>
+#include <deque>
+#include <list>
+#include <set>
+#include <unordered_map>
 #include <algorithm>
+#include <iterator>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <filesystem>
 #include <SFML/Graphics.hpp>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECIPE_BOOK_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace std;
 
-// Base class for all recipes
+using IngredientId = uint32_t;
+
+// Read-only view over a contiguous run of elements, in the spirit of std::span
+template <typename T>
+class ArrayView {
+private:
+    const T* first;
+    size_t count;
+
+public:
+    ArrayView() : first(nullptr), count(0) {}
+
+    ArrayView(const T* data, size_t size) : first(data), count(size) {}
+
+    template <typename Alloc>
+    ArrayView(const vector<T, Alloc>& elements) : first(elements.data()), count(elements.size()) {}
+
+    const T* begin() const {
+        return first;
+    }
+
+    const T* end() const {
+        return first + count;
+    }
+
+    const T* data() const {
+        return first;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        return first[index];
+    }
+};
+
+// Process-wide symbol table that interns ingredient names as compact integer IDs
+class IngredientTable {
+private:
+    unordered_map<string, IngredientId> ids;
+    // Points at the keys of ids, which stay put as the map grows
+    vector<const string*> names;
+
+    IngredientTable() {}
+
+public:
+    static constexpr IngredientId npos = UINT32_MAX;
+
+    static IngredientTable& instance() {
+        static IngredientTable table;
+        return table;
+    }
+
+    // Get the ID for an ingredient, adding it to the table if it is new
+    IngredientId intern(const string& ingredient) {
+        auto it = ids.find(ingredient);
+        if (it != ids.end()) {
+            return it->second;
+        }
+
+        IngredientId id = static_cast<IngredientId>(names.size());
+        it = ids.emplace(ingredient, id).first;
+        names.push_back(&it->first);
+        return id;
+    }
+
+    // Get the ID for an ingredient without adding it; npos if it was never seen
+    IngredientId find(const string& ingredient) const {
+        auto it = ids.find(ingredient);
+        if (it == ids.end()) {
+            return npos;
+        }
+        return it->second;
+    }
+
+    const string& name(IngredientId id) const {
+        return *names[id];
+    }
+
+    string_view name_view(IngredientId id) const {
+        return *names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+
+    template <typename Alloc>
+    void intern_all(const vector<string>& ingredients, vector<IngredientId, Alloc>& result) {
+        result.clear();
+        result.reserve(ingredients.size());
+        for (const auto& ingredient : ingredients) {
+            result.push_back(intern(ingredient));
+        }
+    }
+};
+
+// Identifies a recipe within the RecipeBook that owns it. The generation
+// changes each time a slot is reused, so a handle to a deleted recipe is
+// detected as stale instead of resolving to whatever replaced it.
+struct RecipeHandle {
+    uint32_t index;
+    uint32_t generation;
+
+    RecipeHandle() : index(UINT32_MAX), generation(0) {}
+
+    RecipeHandle(uint32_t i, uint32_t g) : index(i), generation(g) {}
+
+    bool operator==(const RecipeHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const RecipeHandle& other) const {
+        return !(*this == other);
+    }
+};
+
+// Tag identifying the concrete type of a recipe. The set of recipe types is
+// closed, so code can switch on this instead of using dynamic_cast.
+enum class RecipeKind : uint8_t {
+    Plain,
+    MainCourse,
+    Dessert
+};
+
+class RecipeBook;
+struct ImportChunk;
+struct ImportStats;
+
+// Base class for all recipes.
+// Strings and vectors draw from a memory resource so a RecipeBook can place
+// a whole book in its arena; by default they use the global heap.
+//
+// A RecipeBook copies a recipe's fields into its store and indexes when the
+// recipe is added, so from then on the setters refuse and return false;
+// changes go through RecipeBook::update_recipe or
+// RecipeBook::set_cooking_time instead.
 class Recipe {
 public:
-    // Common attributes for all recipes
-    string name;
-    vector<string> ingredients;
-    vector<string> steps;
-    int cookingTime;
+    static constexpr RecipeKind static_kind = RecipeKind::Plain;
 
     // Default constructor
-    Recipe() : name(""), cookingTime(0) {}
+    Recipe() : kind(RecipeKind::Plain), name(""), cookingTime(0), bodySource(nullptr) {}
 
     // Constructor with parameters
-    Recipe(const string& n, const vector<string>& ing, const vector<string>& st, int time)
-        : name(n), ingredients(ing), steps(st), cookingTime(time) {}
+    Recipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, pmr::memory_resource* resource = pmr::get_default_resource())
+        : kind(RecipeKind::Plain), name(n, resource), ingredientIds(resource), steps(resource), cookingTime(time), bodySource(nullptr) {
+        set_ingredients(ing);
+        set_steps(st);
+    }
 
-    // Setters
-    void set_name(const string& n) {
+    virtual ~Recipe() {}
+
+    // Setters, for a recipe not yet in a book
+    bool set_name(const string& n) {
+        if (in_book()) {
+            return false;
+        }
         name = n;
+        return true;
     }
 
-    void set_ingredients(const vector<string>& ing) {
-        ingredients = ing;
+    bool set_ingredients(const vector<string>& ing) {
+        if (in_book()) {
+            return false;
+        }
+        IngredientTable::instance().intern_all(ing, ingredientIds);
+        return true;
     }
 
-    void set_steps(const vector<string>& st) {
-        steps = st;
+    bool set_steps(const vector<string>& st) {
+        if (in_book()) {
+            return false;
+        }
+        steps.clear();
+        steps.reserve(st.size());
+        for (const auto& step : st) {
+            steps.emplace_back(step);
+        }
+        return true;
     }
 
-    void set_cooking_time(int time) {
+    bool set_cooking_time(int time) {
+        if (in_book()) {
+            return false;
+        }
         cookingTime = time;
+        return true;
     }
 
     // Getters
     string get_name() const {
-        return name;
+        return string(name);
     }
 
     vector<string> get_ingredients() const {
-        return ingredients;
+        load_body();
+        const IngredientTable& table = IngredientTable::instance();
+        vector<string> result;
+        result.reserve(ingredientIds.size());
+        for (IngredientId id : ingredientIds) {
+            result.push_back(table.name(id));
+        }
+        return result;
     }
 
-    vector<string> get_steps() const {
+    // Read-only views that avoid copying the underlying strings and vectors
+    string_view name_view() const {
+        return name;
+    }
+
+    ArrayView<IngredientId> ingredient_ids_view() const {
+        load_body();
+        return ingredientIds;
+    }
+
+    ArrayView<pmr::string> steps_view() const {
+        load_body();
         return steps;
     }
 
+    vector<string> get_steps() const {
+        load_body();
+        return vector<string>(steps.begin(), steps.end());
+    }
+
+    // The resource this recipe's strings and vectors allocate from
+    pmr::memory_resource* get_memory_resource() const {
+        return name.get_allocator().resource();
+    }
+
     int get_cooking_time() const {
         return cookingTime;
     }
 
+    RecipeKind get_kind() const {
+        return kind;
+    }
+
+    // Handle assigned by the RecipeBook this recipe was added to
+    RecipeHandle get_handle() const {
+        return handle;
+    }
+
     string get_recipe() const {
+        load_body();
         string temp;
-        temp += "Recipe: " + name + "\n";
+        temp += "Recipe: ";
+        temp += name;
+        temp += "\n";
 
         // Add ingredients
         temp += "Ingredients:\n";
-        for (const auto& ingredient : ingredients) {
-            temp += "- " + ingredient + "\n";
+        for (IngredientId id : ingredientIds) {
+            temp += "- " + IngredientTable::instance().name(id) + "\n";
         }
 
         // Add steps
         temp += "Steps:\n";
         for (const auto& step : steps) {
-            temp += step + "\n";
+            temp += step;
+            temp += "\n";
         }
 
         // Add cooking time
@@ -86,12 +333,17 @@ public:
         return "";  // Default implementation for non-MainCourseRecipe instances
     }
 
+    virtual string_view cuisine_view() const {
+        return string_view();
+    }
+
     // Displaying recipe details
     virtual void display() const {
+        load_body();
         cout << "Recipe: " << name << "\n";
         cout << "Ingredients:\n";
-        for (const auto& ingredient : ingredients) {
-            cout << "- " << ingredient << "\n";
+        for (IngredientId id : ingredientIds) {
+            cout << "- " << IngredientTable::instance().name(id) << "\n";
         }
         cout << "Steps:\n";
         for (const auto& step : steps) {
@@ -112,215 +364,7111 @@ public:
         cout << "Recipe planned for day " << day << ".\n";
     }
 
-    virtual void set_cuisine(const string& c) {
-        // No-op in the base class, as not all recipes have a cuisine
-    }
-};
+    virtual bool set_cuisine(const string& c) {
+        // No-op in the base class, as not all recipes have a cuisine
+        return false;
+    }
+
+protected:
+    // Set by each concrete class's constructors
+    RecipeKind kind;
+
+    // Whether a RecipeBook has added this recipe and indexed its fields
+    bool in_book() const {
+        return handle != RecipeHandle();
+    }
+
+private:
+    friend class RecipeBook;
+    // Fills in recipes the book created, before they are added
+    friend void add_imported_recipes(deque<ImportChunk>& chunks, RecipeBook& book, ImportStats& stats, size_t& linesBefore);
+
+    // Common attributes for all recipes
+    pmr::string name;
+    pmr::vector<IngredientId> ingredientIds;
+    pmr::vector<pmr::string> steps;
+    int cookingTime;
+
+    RecipeHandle handle;
+    // For a recipe loaded without its ingredients and steps, the book that
+    // reads them in the first time an accessor asks for them
+    mutable atomic<const RecipeBook*> bodySource;
+
+    // Defined after RecipeBook
+    void load_body() const;
+};
+
+// Feature class for nutritional information
+class NutritionFeature {
+public:
+    virtual void display_nutritional_info() const = 0;
+};
+
+// Derived class for Main Course recipes
+class MainCourseRecipe final : public Recipe, public NutritionFeature {
+private:
+    // Additional attribute for Main Course recipes
+    pmr::string cuisine;
+
+public:
+    static constexpr RecipeKind static_kind = RecipeKind::MainCourse;
+
+    // Default constructor
+    MainCourseRecipe() : cuisine("") {
+        kind = static_kind;
+    }
+
+    // Constructor with parameters
+    MainCourseRecipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, const string& c, pmr::memory_resource* resource = pmr::get_default_resource())
+        : Recipe(n, ing, st, time, resource), cuisine(c, resource) {
+        kind = static_kind;
+    }
+
+    
+
+    // Setters
+   
+    bool set_cuisine(const string& c) override {
+        if (in_book()) {
+            return false;
+        }
+        cuisine = c;
+        return true;
+    }
+
+    // Override the virtual function to get cuisine
+    string get_cuisine() const override {
+        return string(cuisine);
+    }
+
+    string_view cuisine_view() const override {
+        return cuisine;
+    }
+
+    // Display function
+    void display() const override {
+        Recipe::display();
+        cout << "Cuisine: " << cuisine << "\n";
+    }
+
+    // Function to display nutritional information for Main Course recipes
+    void display_nutritional_info() const override {
+        // Add code to display nutritional information for Main Course recipes
+        cout << "Nutritional information for Main Course: ...\n";
+    }
+};
+
+// Feature class for meal planning
+class MealPlanningFeature {
+public:
+    virtual void generate_meal_plan() const = 0;
+};
+
+// Derived class for Dessert recipes
+class DessertRecipe final : public Recipe, public MealPlanningFeature {
+private:
+    // Additional attribute for Dessert recipes
+    pmr::string type;
+
+public:
+    static constexpr RecipeKind static_kind = RecipeKind::Dessert;
+
+    // Default constructor
+    DessertRecipe() : type("") {
+        kind = static_kind;
+    }
+
+    // Constructor with parameters
+    DessertRecipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, const string& t, pmr::memory_resource* resource = pmr::get_default_resource())
+        : Recipe(n, ing, st, time, resource), type(t, resource) {
+        kind = static_kind;
+    }
+
+    // Setters
+    bool set_type(const string& t) {
+        if (in_book()) {
+            return false;
+        }
+        type = t;
+        return true;
+    }
+
+    // Getters
+    string get_type() const {
+        return string(type);
+    }
+
+    string_view type_view() const {
+        return type;
+    }
+
+    // Display function
+    void display() const override {
+        Recipe::display();
+        cout << "Type: " << type << "\n";
+    }
+
+    // Function to generate meal plan for Dessert recipes
+    void generate_meal_plan() const override {
+        // Add code to generate meal plan for Dessert recipes
+        cout << "Meal plan for Dessert: ...\n";
+    }
+};
+
+// Call visitor with the recipe as its concrete type, chosen by its kind tag.
+// The visitor is typically a generic lambda; calls it makes on the final
+// recipe classes are resolved at compile time rather than through the vtable.
+template <typename Visitor>
+decltype(auto) visit_recipe(Recipe& recipe, Visitor&& visitor) {
+    switch (recipe.get_kind()) {
+    case RecipeKind::MainCourse:
+        return visitor(static_cast<MainCourseRecipe&>(recipe));
+    case RecipeKind::Dessert:
+        return visitor(static_cast<DessertRecipe&>(recipe));
+    default:
+        return visitor(recipe);
+    }
+}
+
+template <typename Visitor>
+decltype(auto) visit_recipe(const Recipe& recipe, Visitor&& visitor) {
+    switch (recipe.get_kind()) {
+    case RecipeKind::MainCourse:
+        return visitor(static_cast<const MainCourseRecipe&>(recipe));
+    case RecipeKind::Dessert:
+        return visitor(static_cast<const DessertRecipe&>(recipe));
+    default:
+        return visitor(recipe);
+    }
+}
+
+// Category a recipe is filed under: the cuisine of a main course or the type
+// of a dessert. Plain recipes have no category.
+inline string_view recipe_category(const Recipe& recipe) {
+    switch (recipe.get_kind()) {
+    case RecipeKind::MainCourse:
+        return static_cast<const MainCourseRecipe&>(recipe).cuisine_view();
+    case RecipeKind::Dessert:
+        return static_cast<const DessertRecipe&>(recipe).type_view();
+    default:
+        return string_view();
+    }
+}
+
+using CategoryId = uint32_t;
+
+// Categories numbered densely from zero, each with the handles of its
+// recipes. Lookups by ID index an array and lookups by name hit a hash
+// table. There is no stored "All" category; RecipeBook presents the whole
+// book as a virtual one instead.
+class CategoryIndex {
+private:
+    // A deque keeps each name at a fixed address for the string_view keys below
+    deque<string> names;
+    unordered_map<string_view, CategoryId> ids;
+    vector<vector<RecipeHandle>> members;
+
+public:
+    static constexpr CategoryId no_category = UINT32_MAX;
+
+    // Stands for the virtual "All" category in RecipeBook's category accessors
+    static constexpr CategoryId all = UINT32_MAX - 1;
+
+    size_t size() const {
+        return names.size();
+    }
+
+    // Get the ID for a category, registering it if it is new
+    CategoryId intern(string_view category) {
+        auto it = ids.find(category);
+        if (it != ids.end()) {
+            return it->second;
+        }
+
+        CategoryId id = static_cast<CategoryId>(names.size());
+        names.emplace_back(category);
+        members.emplace_back();
+        ids.emplace(names.back(), id);
+        return id;
+    }
+
+    // Get the ID for a category without registering it; no_category if unknown
+    CategoryId find(string_view category) const {
+        auto it = ids.find(category);
+        if (it == ids.end()) {
+            return no_category;
+        }
+        return it->second;
+    }
+
+    const string& name(CategoryId id) const {
+        return names[id];
+    }
+
+    const vector<RecipeHandle>& recipes(CategoryId id) const {
+        return members[id];
+    }
+
+    void reserve_additional(CategoryId id, size_t count) {
+        members[id].reserve(members[id].size() + count);
+    }
+
+    // Add a recipe to a category, returning its position there
+    uint32_t add(CategoryId id, RecipeHandle handle) {
+        members[id].push_back(handle);
+        return static_cast<uint32_t>(members[id].size() - 1);
+    }
+
+    // Swap-and-pop the entry at position. Returns the handle that moved into
+    // its place, or a default handle if it was the last entry.
+    RecipeHandle remove(CategoryId id, uint32_t position) {
+        vector<RecipeHandle>& bucket = members[id];
+        RecipeHandle moved = bucket.back();
+        bucket[position] = moved;
+        bucket.pop_back();
+        if (position == bucket.size()) {
+            return RecipeHandle();
+        }
+        return moved;
+    }
+
+    // Drop every entry for which doomed(handle) is true, keeping the rest in
+    // order, and call moved(handle, position) for each entry that shifts
+    template <typename Doomed, typename Moved>
+    void remove_if(Doomed doomed, Moved moved) {
+        for (auto& bucket : members) {
+            uint32_t kept = 0;
+            for (uint32_t position = 0; position < bucket.size(); ++position) {
+                RecipeHandle handle = bucket[position];
+                if (doomed(handle)) {
+                    continue;
+                }
+                if (kept != position) {
+                    bucket[kept] = handle;
+                    moved(handle, kept);
+                }
+                ++kept;
+            }
+            bucket.resize(kept);
+        }
+    }
+
+    void clear() {
+        ids.clear();
+        names.clear();
+        members.clear();
+    }
+};
+
+// Columnar copy of the recipe fields that whole-catalogue filters read.
+// Row i describes RecipeBook::getRecipes()[i]; recipes in a book only change
+// through RecipeBook, which keeps the row in step.
+class RecipeStore {
+private:
+    // Names packed into one buffer; row i spans nameLengths[i] bytes from nameOffsets[i]
+    string namePool;
+    vector<uint32_t> nameOffsets;
+    vector<uint32_t> nameLengths;
+
+    vector<int> cookingTimes;
+    vector<CategoryId> categoryIds;
+
+    // Ingredient IDs packed into one array; row i spans ingredientCounts[i] IDs
+    // from ingredientOffsets[i]
+    vector<uint32_t> ingredientOffsets;
+    vector<uint32_t> ingredientCounts;
+    vector<IngredientId> ingredientIds;
+
+    // Pool space left behind by removed rows, reclaimed by compact()
+    size_t deadNameBytes;
+    size_t deadIngredients;
+
+    // Rewrite both pools in row order, dropping the space of removed rows
+    void compact() {
+        string names;
+        names.reserve(namePool.size() - deadNameBytes);
+        vector<IngredientId> ingredients;
+        ingredients.reserve(ingredientIds.size() - deadIngredients);
+
+        for (size_t row = 0; row < size(); ++row) {
+            uint32_t nameOffset = static_cast<uint32_t>(names.size());
+            names.append(namePool, nameOffsets[row], nameLengths[row]);
+            nameOffsets[row] = nameOffset;
+
+            uint32_t ingredientOffset = static_cast<uint32_t>(ingredients.size());
+            auto first = ingredientIds.begin() + ingredientOffsets[row];
+            ingredients.insert(ingredients.end(), first, first + ingredientCounts[row]);
+            ingredientOffsets[row] = ingredientOffset;
+        }
+
+        namePool.swap(names);
+        ingredientIds.swap(ingredients);
+
+        deadNameBytes = 0;
+        deadIngredients = 0;
+    }
+
+public:
+    RecipeStore() : deadNameBytes(0), deadIngredients(0) {}
+
+    size_t size() const {
+        return cookingTimes.size();
+    }
+
+    // Make room for `rows` more rows holding `ingredients` more ingredient entries
+    void reserve_additional(size_t rows, size_t ingredients, size_t nameBytes) {
+        rows += size();
+        nameOffsets.reserve(rows);
+        nameLengths.reserve(rows);
+        cookingTimes.reserve(rows);
+        categoryIds.reserve(rows);
+        ingredientOffsets.reserve(rows);
+        ingredientCounts.reserve(rows);
+        ingredientIds.reserve(ingredientIds.size() + ingredients);
+        namePool.reserve(namePool.size() + nameBytes);
+    }
+
+    // A row for recipe, which may keep its ingredients elsewhere
+    void append(const Recipe& recipe, CategoryId category, ArrayView<IngredientId> ingredients) {
+        string_view recipeName = recipe.name_view();
+        nameOffsets.push_back(static_cast<uint32_t>(namePool.size()));
+        nameLengths.push_back(static_cast<uint32_t>(recipeName.size()));
+        namePool.append(recipeName.data(), recipeName.size());
+
+        cookingTimes.push_back(recipe.get_cooking_time());
+        categoryIds.push_back(category);
+
+        ingredientOffsets.push_back(static_cast<uint32_t>(ingredientIds.size()));
+        ingredientCounts.push_back(static_cast<uint32_t>(ingredients.size()));
+        ingredientIds.insert(ingredientIds.end(), ingredients.begin(), ingredients.end());
+    }
+
+    // Remove a row by moving the last row into its place, matching how
+    // RecipeBook removes from its dense recipe array
+    void swap_remove(size_t row) {
+        deadNameBytes += nameLengths[row];
+        deadIngredients += ingredientCounts[row];
+
+        size_t last = size() - 1;
+        nameOffsets[row] = nameOffsets[last];
+        nameLengths[row] = nameLengths[last];
+        cookingTimes[row] = cookingTimes[last];
+        categoryIds[row] = categoryIds[last];
+        ingredientOffsets[row] = ingredientOffsets[last];
+        ingredientCounts[row] = ingredientCounts[last];
+
+        nameOffsets.pop_back();
+        nameLengths.pop_back();
+        cookingTimes.pop_back();
+        categoryIds.pop_back();
+        ingredientOffsets.pop_back();
+        ingredientCounts.pop_back();
+
+        // Compact once dead space outweighs live data, keeping removal amortised O(1)
+        if (deadNameBytes > namePool.size() / 2 || deadIngredients > ingredientIds.size() / 2) {
+            compact();
+        }
+    }
+
+    // Remove every row flagged in removeRow in one pass, keeping the
+    // survivors in order, then compact the pools
+    void remove_rows(const vector<char>& removeRow) {
+        size_t kept = 0;
+        for (size_t row = 0; row < size(); ++row) {
+            if (removeRow[row]) {
+                deadNameBytes += nameLengths[row];
+                deadIngredients += ingredientCounts[row];
+                continue;
+            }
+
+            nameOffsets[kept] = nameOffsets[row];
+            nameLengths[kept] = nameLengths[row];
+            cookingTimes[kept] = cookingTimes[row];
+            categoryIds[kept] = categoryIds[row];
+            ingredientOffsets[kept] = ingredientOffsets[row];
+            ingredientCounts[kept] = ingredientCounts[row];
+            ++kept;
+        }
+
+        nameOffsets.resize(kept);
+        nameLengths.resize(kept);
+        cookingTimes.resize(kept);
+        categoryIds.resize(kept);
+        ingredientOffsets.resize(kept);
+        ingredientCounts.resize(kept);
+        compact();
+    }
+
+    // Per-row accessors
+    string_view name(size_t row) const {
+        return string_view(namePool).substr(nameOffsets[row], nameLengths[row]);
+    }
+
+    int cooking_time(size_t row) const {
+        return cookingTimes[row];
+    }
+
+    void set_cooking_time(size_t row, int minutes) {
+        cookingTimes[row] = minutes;
+    }
+
+    CategoryId category_id(size_t row) const {
+        return categoryIds[row];
+    }
+
+    ArrayView<IngredientId> ingredients(size_t row) const {
+        return ArrayView<IngredientId>(ingredientIds.data() + ingredientOffsets[row], ingredientCounts[row]);
+    }
+
+    // Whole columns, for sequential scans
+    ArrayView<int> cooking_times() const {
+        return cookingTimes;
+    }
+
+    ArrayView<CategoryId> category_ids() const {
+        return categoryIds;
+    }
+};
+
+// Portable bit helpers for the bitmap below
+inline uint32_t popcount64(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<uint32_t>(__popcnt64(word));
+#elif defined(__GNUC__)
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#else
+    uint32_t count = 0;
+    for (; word != 0; word &= word - 1) {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// Index of the lowest set bit; word must not be zero
+inline uint32_t lowest_bit(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#elif defined(__GNUC__)
+    return static_cast<uint32_t>(__builtin_ctzll(word));
+#else
+    uint32_t index = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+// Compressed set of 32-bit values (recipe slot indexes) in the style of a
+// Roaring bitmap. Values are grouped by their high 16 bits; each group is a
+// sorted array of low halves while sparse and a 65536-bit bitmap once dense.
+// Set operations on dense groups work a 64-bit word at a time, in loops the
+// compiler can vectorise.
+class RecipeBitmap {
+private:
+    static constexpr uint32_t array_limit = 4096;
+    static constexpr size_t bitmap_words = 65536 / 64;
+
+    struct Container {
+        uint16_t key;
+        uint32_t cardinality;
+        // Exactly one of these is in use: values while cardinality <= array_limit, words otherwise
+        vector<uint16_t> values;
+        vector<uint64_t> words;
+
+        bool is_bitmap() const {
+            return !words.empty();
+        }
+
+        bool test(uint16_t low) const {
+            if (is_bitmap()) {
+                return (words[low >> 6] >> (low & 63)) & 1;
+            }
+            return binary_search(values.begin(), values.end(), low);
+        }
+
+        void to_bitmap() {
+            words.assign(bitmap_words, 0);
+            for (uint16_t low : values) {
+                words[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+            values.clear();
+            values.shrink_to_fit();
+        }
+
+        void to_array() {
+            values.clear();
+            values.reserve(cardinality);
+            for (size_t i = 0; i < bitmap_words; ++i) {
+                for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+                    values.push_back(static_cast<uint16_t>(i * 64 + lowest_bit(word)));
+                }
+            }
+            words.clear();
+            words.shrink_to_fit();
+        }
+
+        // Recount a bitmap container after a word-level operation and switch
+        // back to an array if it has become sparse
+        void finish_words() {
+            cardinality = 0;
+            for (size_t i = 0; i < bitmap_words; ++i) {
+                cardinality += popcount64(words[i]);
+            }
+            if (cardinality <= array_limit) {
+                to_array();
+            }
+        }
+    };
+
+    // Sorted by key
+    vector<Container> containers;
+
+    size_t lower_bound_key(uint16_t key) const {
+        size_t first = 0;
+        size_t last = containers.size();
+        while (first < last) {
+            size_t middle = (first + last) / 2;
+            if (containers[middle].key < key) {
+                first = middle + 1;
+            }
+            else {
+                last = middle;
+            }
+        }
+        return first;
+    }
+
+    static Container intersect_containers(const Container& a, const Container& b) {
+        Container result;
+        result.key = a.key;
+        if (a.is_bitmap() && b.is_bitmap()) {
+            result.words.resize(bitmap_words);
+            for (size_t i = 0; i < bitmap_words; ++i) {
+                result.words[i] = a.words[i] & b.words[i];
+            }
+            result.finish_words();
+        }
+        else if (!a.is_bitmap() && !b.is_bitmap()) {
+            set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(result.values));
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+        }
+        else {
+            const Container& sparse = a.is_bitmap() ? b : a;
+            const Container& dense = a.is_bitmap() ? a : b;
+            for (uint16_t low : sparse.values) {
+                if (dense.test(low)) {
+                    result.values.push_back(low);
+                }
+            }
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+        }
+        return result;
+    }
+
+    static Container unite_containers(const Container& a, const Container& b) {
+        Container result;
+        result.key = a.key;
+        if (!a.is_bitmap() && !b.is_bitmap() && a.cardinality + b.cardinality <= array_limit) {
+            set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(result.values));
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+            return result;
+        }
+
+        result.values = a.values;
+        result.words = a.words;
+        result.cardinality = a.cardinality;
+        if (!result.is_bitmap()) {
+            result.to_bitmap();
+        }
+        if (b.is_bitmap()) {
+            for (size_t i = 0; i < bitmap_words; ++i) {
+                result.words[i] |= b.words[i];
+            }
+        }
+        else {
+            for (uint16_t low : b.values) {
+                result.words[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+        }
+        result.finish_words();
+        return result;
+    }
+
+    static Container subtract_containers(const Container& a, const Container& b) {
+        Container result;
+        result.key = a.key;
+        if (!a.is_bitmap()) {
+            if (b.is_bitmap()) {
+                for (uint16_t low : a.values) {
+                    if (!b.test(low)) {
+                        result.values.push_back(low);
+                    }
+                }
+            }
+            else {
+                set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(), back_inserter(result.values));
+            }
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+            return result;
+        }
+
+        result.words = a.words;
+        if (b.is_bitmap()) {
+            for (size_t i = 0; i < bitmap_words; ++i) {
+                result.words[i] &= ~b.words[i];
+            }
+        }
+        else {
+            for (uint16_t low : b.values) {
+                result.words[low >> 6] &= ~(uint64_t(1) << (low & 63));
+            }
+        }
+        result.finish_words();
+        return result;
+    }
+
+public:
+    bool contains(uint32_t value) const {
+        uint16_t key = static_cast<uint16_t>(value >> 16);
+        size_t index = lower_bound_key(key);
+        return index < containers.size() && containers[index].key == key && containers[index].test(static_cast<uint16_t>(value));
+    }
+
+    void add(uint32_t value) {
+        uint16_t key = static_cast<uint16_t>(value >> 16);
+        uint16_t low = static_cast<uint16_t>(value);
+        size_t index = lower_bound_key(key);
+        if (index == containers.size() || containers[index].key != key) {
+            Container container;
+            container.key = key;
+            container.cardinality = 0;
+            containers.insert(containers.begin() + index, std::move(container));
+        }
+
+        Container& container = containers[index];
+        if (container.is_bitmap()) {
+            uint64_t& word = container.words[low >> 6];
+            uint64_t bit = uint64_t(1) << (low & 63);
+            if ((word & bit) == 0) {
+                word |= bit;
+                ++container.cardinality;
+            }
+            return;
+        }
+
+        auto it = lower_bound(container.values.begin(), container.values.end(), low);
+        if (it != container.values.end() && *it == low) {
+            return;
+        }
+        container.values.insert(it, low);
+        if (++container.cardinality > array_limit) {
+            container.to_bitmap();
+        }
+    }
+
+    // Add values given in ascending order (repeats allowed). Groups that are
+    // new to the bitmap are built in one go rather than a value at a time.
+    void add_sorted(const uint32_t* values, size_t count) {
+        size_t first = 0;
+        while (first < count) {
+            uint16_t key = static_cast<uint16_t>(values[first] >> 16);
+            size_t last = first;
+            while (last < count && static_cast<uint16_t>(values[last] >> 16) == key) {
+                ++last;
+            }
+
+            size_t index = lower_bound_key(key);
+            if (index < containers.size() && containers[index].key == key) {
+                for (size_t i = first; i < last; ++i) {
+                    add(values[i]);
+                }
+            }
+            else {
+                Container container;
+                container.key = key;
+                container.values.reserve(last - first);
+                for (size_t i = first; i < last; ++i) {
+                    uint16_t low = static_cast<uint16_t>(values[i]);
+                    if (container.values.empty() || container.values.back() != low) {
+                        container.values.push_back(low);
+                    }
+                }
+                container.cardinality = static_cast<uint32_t>(container.values.size());
+                if (container.cardinality > array_limit) {
+                    container.to_bitmap();
+                }
+                containers.insert(containers.begin() + index, std::move(container));
+            }
+            first = last;
+        }
+    }
+
+    void remove(uint32_t value) {
+        uint16_t key = static_cast<uint16_t>(value >> 16);
+        uint16_t low = static_cast<uint16_t>(value);
+        size_t index = lower_bound_key(key);
+        if (index == containers.size() || containers[index].key != key) {
+            return;
+        }
+
+        Container& container = containers[index];
+        if (container.is_bitmap()) {
+            uint64_t& word = container.words[low >> 6];
+            uint64_t bit = uint64_t(1) << (low & 63);
+            if ((word & bit) == 0) {
+                return;
+            }
+            word &= ~bit;
+            if (--container.cardinality <= array_limit) {
+                container.to_array();
+            }
+            return;
+        }
+
+        auto it = lower_bound(container.values.begin(), container.values.end(), low);
+        if (it == container.values.end() || *it != low) {
+            return;
+        }
+        container.values.erase(it);
+        if (--container.cardinality == 0) {
+            containers.erase(containers.begin() + index);
+        }
+    }
+
+    void clear() {
+        containers.clear();
+    }
+
+    bool empty() const {
+        return containers.empty();
+    }
+
+    size_t cardinality() const {
+        size_t count = 0;
+        for (const auto& container : containers) {
+            count += container.cardinality;
+        }
+        return count;
+    }
+
+    // Call fn with every value in ascending order
+    template <typename Function>
+    void for_each(Function fn) const {
+        for (const auto& container : containers) {
+            uint32_t high = uint32_t(container.key) << 16;
+            if (container.is_bitmap()) {
+                for (size_t i = 0; i < bitmap_words; ++i) {
+                    for (uint64_t word = container.words[i]; word != 0; word &= word - 1) {
+                        fn(high | static_cast<uint32_t>(i * 64 + lowest_bit(word)));
+                    }
+                }
+            }
+            else {
+                for (uint16_t low : container.values) {
+                    fn(high | low);
+                }
+            }
+        }
+    }
+
+    // Call fn with every value at or above first in ascending order, until
+    // it returns false
+    template <typename Function>
+    void for_each_from(uint32_t first, Function fn) const {
+        for (size_t index = lower_bound_key(static_cast<uint16_t>(first >> 16)); index < containers.size(); ++index) {
+            const Container& container = containers[index];
+            uint32_t high = uint32_t(container.key) << 16;
+            // Only the container holding first starts part way through
+            uint32_t start = high > first ? 0 : first & 0xffff;
+            if (container.is_bitmap()) {
+                for (size_t i = start >> 6; i < bitmap_words; ++i) {
+                    uint64_t word = container.words[i];
+                    if (i == (start >> 6)) {
+                        word &= ~uint64_t(0) << (start & 63);
+                    }
+                    for (; word != 0; word &= word - 1) {
+                        if (!fn(high | static_cast<uint32_t>(i * 64 + lowest_bit(word)))) {
+                            return;
+                        }
+                    }
+                }
+            }
+            else {
+                auto it = lower_bound(container.values.begin(), container.values.end(), static_cast<uint16_t>(start));
+                for (; it != container.values.end(); ++it) {
+                    if (!fn(high | *it)) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    // a AND b
+    static RecipeBitmap intersect(const RecipeBitmap& a, const RecipeBitmap& b) {
+        RecipeBitmap result;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.containers.size() && j < b.containers.size()) {
+            if (a.containers[i].key < b.containers[j].key) {
+                ++i;
+            }
+            else if (b.containers[j].key < a.containers[i].key) {
+                ++j;
+            }
+            else {
+                Container container = intersect_containers(a.containers[i++], b.containers[j++]);
+                if (container.cardinality != 0) {
+                    result.containers.push_back(std::move(container));
+                }
+            }
+        }
+        return result;
+    }
+
+    // a OR b
+    static RecipeBitmap unite(const RecipeBitmap& a, const RecipeBitmap& b) {
+        RecipeBitmap result;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.containers.size() || j < b.containers.size()) {
+            if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key)) {
+                result.containers.push_back(a.containers[i++]);
+            }
+            else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key) {
+                result.containers.push_back(b.containers[j++]);
+            }
+            else {
+                result.containers.push_back(unite_containers(a.containers[i++], b.containers[j++]));
+            }
+        }
+        return result;
+    }
+
+    // a AND NOT b
+    static RecipeBitmap subtract(const RecipeBitmap& a, const RecipeBitmap& b) {
+        RecipeBitmap result;
+        size_t j = 0;
+        for (const auto& container : a.containers) {
+            while (j < b.containers.size() && b.containers[j].key < container.key) {
+                ++j;
+            }
+            if (j == b.containers.size() || b.containers[j].key != container.key) {
+                result.containers.push_back(container);
+                continue;
+            }
+
+            Container difference = subtract_containers(container, b.containers[j]);
+            if (difference.cardinality != 0) {
+                result.containers.push_back(std::move(difference));
+            }
+        }
+        return result;
+    }
+};
+
+// Run fn(i) for every i in [0, count), one contiguous chunk per hardware
+// thread. Small ranges run on the calling thread. fn must be safe to call
+// concurrently for different values of i.
+template <typename Function>
+void parallel_for(size_t count, Function fn) {
+    const size_t minimumChunk = 1024;
+    size_t threadCount = thread::hardware_concurrency();
+    threadCount = min(threadCount, count / minimumChunk);
+    if (threadCount <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    size_t chunk = (count + threadCount - 1) / threadCount;
+    vector<thread> workers;
+    for (size_t t = 1; t < threadCount; ++t) {
+        workers.emplace_back([&fn, t, chunk, count]() {
+            for (size_t i = t * chunk; i < min(count, (t + 1) * chunk); ++i) {
+                fn(i);
+            }
+        });
+    }
+    for (size_t i = 0; i < min(count, chunk); ++i) {
+        fn(i);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Read-only memory mapping of a whole file. Pages are read in on first touch
+// and shared with every other process that maps the same file.
+class MappedFile {
+private:
+    const char* first;
+    size_t length;
+
+public:
+    MappedFile() : first(nullptr), length(0) {}
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : first(other.first), length(other.length) {
+        other.first = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            first = other.first;
+            length = other.length;
+            other.first = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    // Map the file at path, replacing any current mapping. Empty files
+    // cannot be mapped and count as a failure.
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        // The view keeps the file and mapping objects alive once it exists
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr) {
+            return false;
+        }
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr) {
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+            ::close(descriptor);
+            return false;
+        }
+
+        // The mapping outlives the descriptor
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+        ::close(descriptor);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+#endif
+        first = static_cast<const char*>(view);
+        return true;
+    }
+
+    void close() {
+        if (first == nullptr) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(first);
+#else
+        munmap(const_cast<char*>(first), length);
+#endif
+        first = nullptr;
+        length = 0;
+    }
+
+    bool is_open() const {
+        return first != nullptr;
+    }
+
+    const char* data() const {
+        return first;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Move the file at from over the one at to, replacing it in one step. On
+// Windows the move is on disk when this returns; elsewhere it needs a
+// sync_parent_directory to follow.
+inline bool replace_file(const string& from, const string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// Flush the contents of the file at path to the disk
+inline bool sync_path(const string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool synced = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return synced;
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    bool synced = fsync(file) == 0;
+    ::close(file);
+    return synced;
+#endif
+}
+
+// Flush the directory holding path, so a file created or renamed there
+// survives a crash. Windows has no directory handle to flush; replace_file
+// moves with MOVEFILE_WRITE_THROUGH there instead.
+inline bool sync_parent_directory(const string& path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    string parent = filesystem::path(path).parent_path().string();
+    int directory = ::open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory < 0) {
+        return false;
+    }
+    bool synced = fsync(directory) == 0;
+    ::close(directory);
+    return synced;
+#endif
+}
+
+// replace_file for a freshly written file: its data reaches the disk before
+// the rename, and the rename before this returns. Once it returns true the
+// new file is what a crash will leave behind.
+inline bool replace_file_durably(const string& from, const string& to) {
+    if (!sync_path(from)) {
+        return false;
+    }
+    return replace_file(from, to) && sync_parent_directory(to);
+}
+
+// CRC-32 (the zlib/PNG polynomial) of size bytes, continuing from crc
+inline uint32_t crc32(const void* data, size_t size, uint32_t crc = 0) {
+    static const auto table = []() {
+        array<uint32_t, 256> entries;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// A recipe book saved by RecipeBook::save_image, read in place through a
+// memory mapping. The file is a header followed by flat arrays (sections),
+// each starting on an 8-byte boundary and stored in the byte order of the
+// machine that wrote it. Strings live in one shared pool and are referred to
+// by offset and length. Ingredient IDs number the image's own name table;
+// category IDs are the book's. A CRC-32 in the header covers the header and
+// the sections, so a torn or damaged image is refused rather than loaded.
+//
+// A delta image, written by RecipeBook::save_delta, holds only the slots
+// that changed since the previous checkpoint and the categories added since.
+//
+// A whole image also carries the book's indexes prebuilt, in a block after
+// the sections found through a footer at the very end of the file. The block
+// has its own version and a CRC-32, so loading can fall back to rebuilding
+// the indexes when it is missing, outdated or damaged.
+class RecipeImage {
+public:
+    // A run of elements in another section
+    struct Range {
+        uint64_t offset;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    enum class Section : uint32_t {
+        RecipeNames,        // Range per recipe, into StringPool
+        CookingTimes,       // int32_t per recipe
+        CategoryIds,        // CategoryId per recipe, into CategoryNames
+        Kinds,              // RecipeKind per recipe
+        RecipeIngredients,  // Range per recipe, into IngredientIds
+        RecipeSteps,        // Range per recipe, into Steps
+        IngredientIds,      // IngredientId, into IngredientNames
+        Steps,              // Range per step, into StringPool
+        IngredientNames,    // Range per ingredient, into StringPool
+        IngredientsByName,  // IngredientId per ingredient, sorted by name
+        CategoryNames,      // Range per category from firstCategory, into StringPool
+        RecipeSlots,        // RecipeBook slot index per recipe
+        ChangedSlots,       // RecipeBook slot indexes a delta rewrites
+        SlotGenerations,    // Generation per slot, or per changed slot in a delta
+        FreeSlots,          // Free RecipeBook slot indexes, next to reuse last
+        StringPool,         // char
+        Count
+    };
+
+    static constexpr size_t section_count = static_cast<size_t>(Section::Count);
+
+    struct SectionExtent {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        // byte_order_mark as the writer stored it; reads back differently on
+        // a machine of the opposite endianness
+        uint32_t byteOrder;
+        uint64_t flags;
+        uint64_t recipeCount;
+        uint64_t ingredientCount;
+        uint64_t categoryCount;
+        uint64_t firstCategory;
+        uint64_t slotCount;
+        // Checkpoint number; each delta follows the image numbered one less
+        uint64_t checkpoint;
+        // Last OperationLog record reflected in the image
+        uint64_t logSequence;
+        // CRC-32 of the bytes from the end of the header to the end of the
+        // last section, continued over the header with this field zero
+        uint32_t checksum;
+        uint32_t reserved;
+        SectionExtent sections[section_count];
+    };
+
+    // Last bytes of a file with an index block
+    struct IndexFooter {
+        char magic[8];
+        uint64_t offset;
+        uint64_t size;
+        uint32_t version;
+        // CRC-32 of the whole block
+        uint32_t checksum;
+    };
+
+    // Start of the index block. The arrays follow in this order, each
+    // 8-byte aligned: ingredients + 1 posting starts (uint64_t), categories
+    // + 1 member starts (uint64_t), times TimeEntry, postings slots, members
+    // slots, live slots (uint32_t).
+    struct IndexCounts {
+        uint64_t ingredients;
+        uint64_t categories;
+        uint64_t times;
+        uint64_t postings;
+        uint64_t members;
+        uint64_t live;
+    };
+
+    // Entry of the cooking-time index, sorted by time and then slot
+    struct TimeEntry {
+        int32_t time;
+        uint32_t slot;
+    };
+
+    static constexpr char magic[9] = "RBOOKIMG";
+    static constexpr char index_magic[9] = "RBOOKIDX";
+    static constexpr uint32_t index_version = 1;
+    static constexpr uint32_t current_version = 4;
+    static constexpr uint64_t delta_flag = 1;
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+    static constexpr size_t alignment = 8;
+
+private:
+    MappedFile file;
+    const Header* header;
+    // The index block, when the footer describes a well-formed one
+    const IndexCounts* indexCounts;
+
+    static uint64_t aligned(uint64_t size) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // Byte offsets of the index arrays from the start of the block, in the
+    // order IndexCounts lists them, then the block's total size
+    static array<uint64_t, 7> index_layout(const IndexCounts& counts) {
+        array<uint64_t, 7> offsets;
+        offsets[0] = sizeof(IndexCounts);
+        offsets[1] = offsets[0] + aligned((counts.ingredients + 1) * sizeof(uint64_t));
+        offsets[2] = offsets[1] + aligned((counts.categories + 1) * sizeof(uint64_t));
+        offsets[3] = offsets[2] + aligned(counts.times * sizeof(TimeEntry));
+        offsets[4] = offsets[3] + aligned(counts.postings * sizeof(uint32_t));
+        offsets[5] = offsets[4] + aligned(counts.members * sizeof(uint32_t));
+        offsets[6] = offsets[5] + aligned(counts.live * sizeof(uint32_t));
+        return offsets;
+    }
+
+    template <typename T>
+    const T* index_array(size_t which) const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const char*>(indexCounts) + index_layout(*indexCounts)[which]);
+    }
+
+    // Find the index block, checking only its footer and sizes
+    const IndexCounts* find_indexes() const {
+        if (is_delta() || file.size() < sizeof(IndexFooter)) {
+            return nullptr;
+        }
+        const IndexFooter* footer = reinterpret_cast<const IndexFooter*>(file.data() + file.size() - sizeof(IndexFooter));
+        uint64_t sectionsEnd = 0;
+        for (const SectionExtent& extent : header->sections) {
+            sectionsEnd = max(sectionsEnd, extent.offset + extent.size);
+        }
+        // The block runs right up to the footer. Compared without adding
+        // offset and size, which a damaged footer could make overflow.
+        uint64_t indexEnd = file.size() - sizeof(IndexFooter);
+        if (!equal(index_magic, index_magic + sizeof(footer->magic), footer->magic) || footer->version != index_version
+            || footer->offset % alignment != 0 || footer->offset < sectionsEnd || footer->offset > indexEnd
+            || footer->size != indexEnd - footer->offset || footer->size < sizeof(IndexCounts)) {
+            return nullptr;
+        }
+
+        const IndexCounts* counts = reinterpret_cast<const IndexCounts*>(file.data() + footer->offset);
+        // Bound the counts before sizing the arrays from them
+        if (counts->ingredients != header->ingredientCount || counts->categories != header->categoryCount
+            || counts->times != header->recipeCount || counts->live != header->recipeCount
+            || counts->postings > footer->size || counts->members > footer->size) {
+            return nullptr;
+        }
+        if (index_layout(*counts)[6] != footer->size) {
+            return nullptr;
+        }
+        return counts;
+    }
+
+    const SectionExtent& extent(Section section) const {
+        return header->sections[static_cast<size_t>(section)];
+    }
+
+    template <typename T>
+    const T* section(Section section) const {
+        return reinterpret_cast<const T*>(file.data() + extent(section).offset);
+    }
+
+    template <typename T>
+    size_t section_length(Section section) const {
+        return static_cast<size_t>(extent(section).size / sizeof(T));
+    }
+
+    // The elements a range selects, or an empty view if it runs off the end
+    // of its section, so a damaged file cannot cause reads outside the mapping
+    template <typename T>
+    ArrayView<T> elements(Section section, const Range& range) const {
+        size_t length = section_length<T>(section);
+        if (range.offset > length || range.count > length - range.offset) {
+            return ArrayView<T>(nullptr, 0);
+        }
+        return ArrayView<T>(this->section<T>(section) + range.offset, range.count);
+    }
+
+    string_view pool_string(const Range& range) const {
+        ArrayView<char> text = elements<char>(Section::StringPool, range);
+        return string_view(text.data(), text.size());
+    }
+
+    // Check the header describes a well-formed image, before trusting its
+    // extents enough to read the sections
+    bool valid() const {
+        if (file.size() < sizeof(Header)) {
+            return false;
+        }
+        if (!equal(magic, magic + sizeof(header->magic), header->magic) || header->version != current_version || header->byteOrder != byte_order_mark) {
+            return false;
+        }
+
+        for (const SectionExtent& extent : header->sections) {
+            if (extent.offset % alignment != 0 || extent.offset > file.size() || extent.size > file.size() - extent.offset) {
+                return false;
+            }
+        }
+
+        const uint64_t recipes = header->recipeCount;
+        return extent(Section::RecipeNames).size == recipes * sizeof(Range)
+            && extent(Section::CookingTimes).size == recipes * sizeof(int32_t)
+            && extent(Section::CategoryIds).size == recipes * sizeof(CategoryId)
+            && extent(Section::Kinds).size == recipes * sizeof(RecipeKind)
+            && extent(Section::RecipeIngredients).size == recipes * sizeof(Range)
+            && extent(Section::RecipeSteps).size == recipes * sizeof(Range)
+            && extent(Section::IngredientIds).size % sizeof(IngredientId) == 0
+            && extent(Section::Steps).size % sizeof(Range) == 0
+            && extent(Section::IngredientNames).size == header->ingredientCount * sizeof(Range)
+            && extent(Section::IngredientsByName).size == header->ingredientCount * sizeof(IngredientId)
+            && extent(Section::CategoryNames).size == header->categoryCount * sizeof(Range)
+            && extent(Section::RecipeSlots).size == recipes * sizeof(uint32_t)
+            && extent(Section::ChangedSlots).size % sizeof(uint32_t) == 0
+            && extent(Section::SlotGenerations).size == (is_delta() ? extent(Section::ChangedSlots).size : header->slotCount * sizeof(uint32_t))
+            && extent(Section::FreeSlots).size % sizeof(uint32_t) == 0
+            && header->firstCategory + header->categoryCount <= CategoryIndex::all;
+    }
+
+    // Whether the header and sections still match the checksum they were
+    // written with. Reads every section once; the index block has its own.
+    bool intact() const {
+        uint64_t sectionsEnd = sizeof(Header);
+        for (const SectionExtent& extent : header->sections) {
+            sectionsEnd = max(sectionsEnd, extent.offset + extent.size);
+        }
+        uint32_t checksum = crc32(file.data() + sizeof(Header), static_cast<size_t>(sectionsEnd - sizeof(Header)));
+        Header unsummed = *header;
+        unsummed.checksum = 0;
+        return crc32(&unsummed, sizeof(unsummed), checksum) == header->checksum;
+    }
+
+public:
+    RecipeImage() : header(nullptr), indexCounts(nullptr) {}
+
+    // Map an image file. Fails if it cannot be mapped, its header does not
+    // describe a well-formed image of this version, or its checksum does not
+    // match.
+    bool open(const string& path) {
+        close();
+        if (!file.open(path)) {
+            return false;
+        }
+        header = reinterpret_cast<const Header*>(file.data());
+        if (!valid() || !intact()) {
+            close();
+            return false;
+        }
+        indexCounts = find_indexes();
+        return true;
+    }
+
+    void close() {
+        file.close();
+        header = nullptr;
+        indexCounts = nullptr;
+    }
+
+    bool is_open() const {
+        return header != nullptr;
+    }
+
+    // Whether this is a delta rather than a whole book
+    bool is_delta() const {
+        return (header->flags & delta_flag) != 0;
+    }
+
+    uint64_t checkpoint() const {
+        return header->checkpoint;
+    }
+
+    // Number of recipes
+    size_t size() const {
+        return static_cast<size_t>(header->recipeCount);
+    }
+
+    // Per-recipe accessors. Strings and arrays point into the mapping and
+    // stay valid until the image is closed.
+    string_view name(size_t row) const {
+        return pool_string(section<Range>(Section::RecipeNames)[row]);
+    }
+
+    int cooking_time(size_t row) const {
+        return section<int32_t>(Section::CookingTimes)[row];
+    }
+
+    // CategoryIndex::no_category for recipes without one
+    CategoryId category_id(size_t row) const {
+        return section<CategoryId>(Section::CategoryIds)[row];
+    }
+
+    RecipeKind kind(size_t row) const {
+        RecipeKind kind = section<RecipeKind>(Section::Kinds)[row];
+        if (kind != RecipeKind::MainCourse && kind != RecipeKind::Dessert) {
+            return RecipeKind::Plain;
+        }
+        return kind;
+    }
+
+    // IDs into this image's ingredient names
+    ArrayView<IngredientId> ingredients(size_t row) const {
+        return elements<IngredientId>(Section::IngredientIds, section<Range>(Section::RecipeIngredients)[row]);
+    }
+
+    size_t step_count(size_t row) const {
+        return elements<Range>(Section::Steps, section<Range>(Section::RecipeSteps)[row]).size();
+    }
+
+    string_view step(size_t row, size_t i) const {
+        return pool_string(elements<Range>(Section::Steps, section<Range>(Section::RecipeSteps)[row])[i]);
+    }
+
+    // Whole columns, for sequential scans
+    ArrayView<int32_t> cooking_times() const {
+        return ArrayView<int32_t>(section<int32_t>(Section::CookingTimes), size());
+    }
+
+    ArrayView<CategoryId> category_ids() const {
+        return ArrayView<CategoryId>(section<CategoryId>(Section::CategoryIds), size());
+    }
+
+    // The image's ingredient vocabulary
+    size_t ingredient_count() const {
+        return static_cast<size_t>(header->ingredientCount);
+    }
+
+    string_view ingredient_name(IngredientId id) const {
+        if (id >= ingredient_count()) {
+            return string_view();
+        }
+        return pool_string(section<Range>(Section::IngredientNames)[id]);
+    }
+
+    // Binary search of the sorted name table; IngredientTable::npos if absent
+    IngredientId find_ingredient(string_view ingredient) const {
+        const IngredientId* first = section<IngredientId>(Section::IngredientsByName);
+        const IngredientId* last = first + ingredient_count();
+        const IngredientId* it = lower_bound(first, last, ingredient, [this](IngredientId id, string_view value) {
+            return ingredient_name(id) < value;
+        });
+        if (it == last || ingredient_name(*it) != ingredient) {
+            return IngredientTable::npos;
+        }
+        return *it;
+    }
+
+    // The slot layout of the RecipeBook that was saved, so loading it into an
+    // empty book can hand out the same handles
+    uint32_t slot(size_t row) const {
+        return section<uint32_t>(Section::RecipeSlots)[row];
+    }
+
+    size_t slot_count() const {
+        return static_cast<size_t>(header->slotCount);
+    }
+
+    // Slots a delta rewrites: each is either free or holds one of the
+    // delta's recipes afterwards
+    size_t changed_slot_count() const {
+        return section_length<uint32_t>(Section::ChangedSlots);
+    }
+
+    uint32_t changed_slot(size_t i) const {
+        return section<uint32_t>(Section::ChangedSlots)[i];
+    }
+
+    // Generation of slot i, or in a delta of changed slot i
+    uint32_t slot_generation(size_t i) const {
+        return section<uint32_t>(Section::SlotGenerations)[i];
+    }
+
+    ArrayView<uint32_t> free_slots() const {
+        return ArrayView<uint32_t>(section<uint32_t>(Section::FreeSlots), section_length<uint32_t>(Section::FreeSlots));
+    }
+
+    // Records of the operation log up to this sequence number are already
+    // part of the image
+    uint64_t log_sequence() const {
+        return header->logSequence;
+    }
+
+    // The image names categories first_category() onwards; a whole book
+    // starts from zero and a delta from the first category it added
+    CategoryId first_category() const {
+        return static_cast<CategoryId>(header->firstCategory);
+    }
+
+    size_t category_count() const {
+        return static_cast<size_t>(header->categoryCount);
+    }
+
+    string_view category_name(CategoryId id) const {
+        if (id < first_category() || id - first_category() >= category_count()) {
+            return string_view();
+        }
+        return pool_string(section<Range>(Section::CategoryNames)[id - first_category()]);
+    }
+
+    // Whether the file has an index block of this version. Its contents are
+    // only trusted once indexes_intact() has checked them.
+    bool has_indexes() const {
+        return indexCounts != nullptr;
+    }
+
+    // Check the index block's checksum and that every start and slot in it
+    // is in range. Reads the whole block.
+    bool indexes_intact() const {
+        if (indexCounts == nullptr) {
+            return false;
+        }
+        const IndexFooter* footer = reinterpret_cast<const IndexFooter*>(file.data() + file.size() - sizeof(IndexFooter));
+        if (crc32(indexCounts, static_cast<size_t>(footer->size)) != footer->checksum) {
+            return false;
+        }
+
+        auto starts_valid = [](const uint64_t* starts, uint64_t count, uint64_t total) {
+            if (starts[0] != 0 || starts[count] != total) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; ++i) {
+                if (starts[i] > starts[i + 1]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        auto slots_valid = [this](const uint32_t* values, uint64_t count) {
+            return all_of(values, values + count, [this](uint32_t slot) { return slot < header->slotCount; });
+        };
+        const IndexCounts& counts = *indexCounts;
+        ArrayView<TimeEntry> times = cooking_time_index();
+        return starts_valid(index_array<uint64_t>(0), counts.ingredients, counts.postings)
+            && starts_valid(index_array<uint64_t>(1), counts.categories, counts.members)
+            && all_of(times.begin(), times.end(), [this](const TimeEntry& entry) { return entry.slot < header->slotCount; })
+            && slots_valid(index_array<uint32_t>(3), counts.postings)
+            && slots_valid(index_array<uint32_t>(4), counts.members)
+            && slots_valid(index_array<uint32_t>(5), counts.live);
+    }
+
+    // Prebuilt indexes; only valid when has_indexes() is true. Slots of the
+    // recipes using an ingredient, sorted, with one entry per use
+    ArrayView<uint32_t> ingredient_postings(IngredientId id) const {
+        const uint64_t* starts = index_array<uint64_t>(0);
+        return ArrayView<uint32_t>(index_array<uint32_t>(3) + starts[id], static_cast<size_t>(starts[id + 1] - starts[id]));
+    }
+
+    // Slots of a category's recipes, in member order
+    ArrayView<uint32_t> category_members(CategoryId id) const {
+        const uint64_t* starts = index_array<uint64_t>(1);
+        return ArrayView<uint32_t>(index_array<uint32_t>(4) + starts[id], static_cast<size_t>(starts[id + 1] - starts[id]));
+    }
+
+    ArrayView<TimeEntry> cooking_time_index() const {
+        return ArrayView<TimeEntry>(index_array<TimeEntry>(2), static_cast<size_t>(indexCounts->times));
+    }
+
+    // Slots of every recipe, sorted
+    ArrayView<uint32_t> live_slots() const {
+        return ArrayView<uint32_t>(index_array<uint32_t>(5), static_cast<size_t>(indexCounts->live));
+    }
+
+    // Write source to path as an image. Source supplies the rows and tables;
+    // see RecipeBook::ImageSource for the members it needs. Ingredients are
+    // renumbered in order of first use, so the image names only those its
+    // rows use.
+    template <typename Source>
+    static bool write(const string& path, const Source& source) {
+        static_assert(sizeof(int) == sizeof(int32_t), "cooking times are stored as 32-bit integers");
+        const size_t rowCount = source.size();
+
+        // Size every section first so the header can go at the front
+        vector<IngredientId> localIds(source.ingredient_space(), IngredientTable::npos);
+        vector<IngredientId> vocabulary;
+        uint64_t ingredientEntries = 0;
+        uint64_t stepCount = 0;
+        uint64_t poolSize = 0;
+        for (size_t row = 0; row < rowCount; ++row) {
+            poolSize += source.name(row).size();
+            source.for_each_ingredient(row, [&](IngredientId id) {
+                ++ingredientEntries;
+                if (localIds[id] == IngredientTable::npos) {
+                    localIds[id] = static_cast<IngredientId>(vocabulary.size());
+                    vocabulary.push_back(id);
+                    poolSize += source.ingredient_name(id).size();
+                }
+            });
+            size_t steps = source.step_count(row);
+            stepCount += steps;
+            for (size_t i = 0; i < steps; ++i) {
+                poolSize += source.step(row, i).size();
+            }
+        }
+        const CategoryId firstCategory = source.first_category();
+        const CategoryId endCategory = firstCategory + static_cast<CategoryId>(source.category_count());
+        for (CategoryId id = firstCategory; id < endCategory; ++id) {
+            poolSize += source.category_name(id).size();
+        }
+        const size_t changedSlots = source.changed_slot_count();
+        const size_t generations = source.is_delta() ? changedSlots : source.slot_count();
+        const ArrayView<uint32_t> freeSlots = source.free_slots();
+
+        // In Section order
+        const uint64_t sectionSizes[section_count] = {
+            rowCount * sizeof(Range),
+            rowCount * sizeof(int32_t),
+            rowCount * sizeof(CategoryId),
+            rowCount * sizeof(RecipeKind),
+            rowCount * sizeof(Range),
+            rowCount * sizeof(Range),
+            ingredientEntries * sizeof(IngredientId),
+            stepCount * sizeof(Range),
+            vocabulary.size() * sizeof(Range),
+            vocabulary.size() * sizeof(IngredientId),
+            (endCategory - firstCategory) * sizeof(Range),
+            rowCount * sizeof(uint32_t),
+            changedSlots * sizeof(uint32_t),
+            generations * sizeof(uint32_t),
+            freeSlots.size() * sizeof(uint32_t),
+            poolSize
+        };
+
+        Header header = {};
+        copy(magic, magic + sizeof(header.magic), header.magic);
+        header.version = current_version;
+        header.byteOrder = byte_order_mark;
+        header.flags = source.is_delta() ? delta_flag : 0;
+        header.recipeCount = rowCount;
+        header.ingredientCount = vocabulary.size();
+        header.categoryCount = endCategory - firstCategory;
+        header.firstCategory = firstCategory;
+        header.slotCount = source.slot_count();
+        header.checkpoint = source.checkpoint();
+        header.logSequence = source.log_sequence();
+        uint64_t offset = sizeof(header);
+        for (size_t i = 0; i < section_count; ++i) {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            header.sections[i].offset = offset;
+            header.sections[i].size = sectionSizes[i];
+            offset += sectionSizes[i];
+        }
+
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        uint64_t written = 0;
+        // Summed from the end of the header until the index block
+        uint32_t checksum = 0;
+        bool summing = false;
+        auto write_bytes = [&](const void* data, size_t size) {
+            out.write(static_cast<const char*>(data), size);
+            written += size;
+            if (summing) {
+                checksum = crc32(data, size, checksum);
+            }
+        };
+        auto write_u32 = [&](uint32_t value) {
+            write_bytes(&value, sizeof(value));
+        };
+        auto begin_section = [&](Section section) {
+            static const char padding[alignment] = {};
+            write_bytes(padding, static_cast<size_t>(header.sections[static_cast<size_t>(section)].offset - written));
+        };
+        auto write_range = [&](uint64_t first, size_t count) {
+            Range range = { first, static_cast<uint32_t>(count), 0 };
+            write_bytes(&range, sizeof(range));
+        };
+
+        // Strings are laid out in the pool in the order their ranges are written
+        uint64_t poolOffset = 0;
+        auto write_string_range = [&](string_view text) {
+            write_range(poolOffset, text.size());
+            poolOffset += text.size();
+        };
+
+        write_bytes(&header, sizeof(header));
+        summing = true;
+
+        begin_section(Section::RecipeNames);
+        for (size_t row = 0; row < rowCount; ++row) {
+            write_string_range(source.name(row));
+        }
+
+        begin_section(Section::CookingTimes);
+        for (size_t row = 0; row < rowCount; ++row) {
+            int32_t time = source.cooking_time(row);
+            write_bytes(&time, sizeof(time));
+        }
+
+        begin_section(Section::CategoryIds);
+        for (size_t row = 0; row < rowCount; ++row) {
+            write_u32(source.category_id(row));
+        }
+
+        begin_section(Section::Kinds);
+        for (size_t row = 0; row < rowCount; ++row) {
+            RecipeKind kind = source.kind(row);
+            write_bytes(&kind, sizeof(kind));
+        }
+
+        begin_section(Section::RecipeIngredients);
+        uint64_t ingredientOffset = 0;
+        for (size_t row = 0; row < rowCount; ++row) {
+            size_t count = source.ingredient_count(row);
+            write_range(ingredientOffset, count);
+            ingredientOffset += count;
+        }
+
+        begin_section(Section::RecipeSteps);
+        uint64_t stepOffset = 0;
+        for (size_t row = 0; row < rowCount; ++row) {
+            size_t count = source.step_count(row);
+            write_range(stepOffset, count);
+            stepOffset += count;
+        }
+
+        begin_section(Section::IngredientIds);
+        for (size_t row = 0; row < rowCount; ++row) {
+            source.for_each_ingredient(row, [&](IngredientId id) {
+                write_u32(localIds[id]);
+            });
+        }
+
+        begin_section(Section::Steps);
+        for (size_t row = 0; row < rowCount; ++row) {
+            size_t steps = source.step_count(row);
+            for (size_t i = 0; i < steps; ++i) {
+                write_string_range(source.step(row, i));
+            }
+        }
+
+        begin_section(Section::IngredientNames);
+        for (IngredientId id : vocabulary) {
+            write_string_range(source.ingredient_name(id));
+        }
+
+        begin_section(Section::IngredientsByName);
+        vector<IngredientId> byName(vocabulary.size());
+        for (IngredientId id = 0; id < byName.size(); ++id) {
+            byName[id] = id;
+        }
+        sort(byName.begin(), byName.end(), [&](IngredientId a, IngredientId b) {
+            return source.ingredient_name(vocabulary[a]) < source.ingredient_name(vocabulary[b]);
+        });
+        write_bytes(byName.data(), byName.size() * sizeof(IngredientId));
+
+        begin_section(Section::CategoryNames);
+        for (CategoryId id = firstCategory; id < endCategory; ++id) {
+            write_string_range(source.category_name(id));
+        }
+
+        begin_section(Section::RecipeSlots);
+        for (size_t row = 0; row < rowCount; ++row) {
+            write_u32(source.slot(row));
+        }
+
+        begin_section(Section::ChangedSlots);
+        for (size_t i = 0; i < changedSlots; ++i) {
+            write_u32(source.changed_slot(i));
+        }
+
+        begin_section(Section::SlotGenerations);
+        for (size_t i = 0; i < generations; ++i) {
+            write_u32(source.slot_generation(i));
+        }
+
+        begin_section(Section::FreeSlots);
+        write_bytes(freeSlots.data(), freeSlots.size() * sizeof(uint32_t));
+
+        begin_section(Section::StringPool);
+        for (size_t row = 0; row < rowCount; ++row) {
+            string_view name = source.name(row);
+            write_bytes(name.data(), name.size());
+        }
+        for (size_t row = 0; row < rowCount; ++row) {
+            size_t steps = source.step_count(row);
+            for (size_t i = 0; i < steps; ++i) {
+                string_view step = source.step(row, i);
+                write_bytes(step.data(), step.size());
+            }
+        }
+        for (IngredientId id : vocabulary) {
+            string_view name = source.ingredient_name(id);
+            write_bytes(name.data(), name.size());
+        }
+        for (CategoryId id = firstCategory; id < endCategory; ++id) {
+            string_view name = source.category_name(id);
+            write_bytes(name.data(), name.size());
+        }
+
+        // Now the sections are known, go back and fill in the checksum
+        summing = false;
+        header.checksum = crc32(&header, sizeof(header), checksum);
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.seekp(static_cast<streamoff>(written));
+
+        if (!source.is_delta()) {
+            write_indexes(source, localIds, vocabulary.size(), endCategory, written, write_bytes);
+        }
+
+        out.close();
+        return static_cast<bool>(out);
+    }
+
+private:
+    // Build the indexes RecipeBook would build from source's rows and write
+    // them as an index block and footer, starting at the next aligned offset
+    template <typename Source, typename WriteBytes>
+    static void write_indexes(const Source& source, const vector<IngredientId>& localIds, size_t ingredientCount, CategoryId categoryCount, uint64_t written, WriteBytes& write_bytes) {
+        const size_t rowCount = source.size();
+        IndexCounts counts = {};
+        counts.ingredients = ingredientCount;
+        counts.categories = categoryCount;
+        counts.times = rowCount;
+        counts.live = rowCount;
+
+        // Postings grouped by ingredient with a counting sort
+        vector<uint64_t> postingStarts(ingredientCount + 1, 0);
+        for (size_t row = 0; row < rowCount; ++row) {
+            source.for_each_ingredient(row, [&](IngredientId id) {
+                ++postingStarts[localIds[id] + 1];
+            });
+        }
+        for (size_t id = 0; id < ingredientCount; ++id) {
+            postingStarts[id + 1] += postingStarts[id];
+        }
+        counts.postings = postingStarts[ingredientCount];
+        vector<uint32_t> postings(static_cast<size_t>(counts.postings));
+        vector<uint64_t> cursor(postingStarts.begin(), postingStarts.end() - 1);
+        for (size_t row = 0; row < rowCount; ++row) {
+            uint32_t slot = source.slot(row);
+            source.for_each_ingredient(row, [&](IngredientId id) {
+                postings[cursor[localIds[id]]++] = slot;
+            });
+        }
+        for (size_t id = 0; id < ingredientCount; ++id) {
+            sort(postings.begin() + postingStarts[id], postings.begin() + postingStarts[id + 1]);
+        }
+
+        // Category members in row order, as adding the rows in order lists them
+        vector<uint64_t> memberStarts(categoryCount + 1, 0);
+        for (size_t row = 0; row < rowCount; ++row) {
+            CategoryId id = source.category_id(row);
+            if (id < categoryCount) {
+                ++memberStarts[id + 1];
+            }
+        }
+        for (CategoryId id = 0; id < categoryCount; ++id) {
+            memberStarts[id + 1] += memberStarts[id];
+        }
+        counts.members = memberStarts[categoryCount];
+        vector<uint32_t> members(static_cast<size_t>(counts.members));
+        cursor.assign(memberStarts.begin(), memberStarts.end() - 1);
+        for (size_t row = 0; row < rowCount; ++row) {
+            CategoryId id = source.category_id(row);
+            if (id < categoryCount) {
+                members[cursor[id]++] = source.slot(row);
+            }
+        }
+
+        vector<TimeEntry> times(rowCount);
+        vector<uint32_t> live(rowCount);
+        for (size_t row = 0; row < rowCount; ++row) {
+            times[row] = TimeEntry{ source.cooking_time(row), source.slot(row) };
+            live[row] = source.slot(row);
+        }
+        sort(times.begin(), times.end(), [](const TimeEntry& a, const TimeEntry& b) {
+            return a.time != b.time ? a.time < b.time : a.slot < b.slot;
+        });
+        sort(live.begin(), live.end());
+
+        static const char padding[alignment] = {};
+        uint64_t blockOffset = aligned(written);
+        write_bytes(padding, static_cast<size_t>(blockOffset - written));
+
+        uint32_t checksum = 0;
+        uint64_t blockSize = 0;
+        auto write_array = [&](const void* data, uint64_t size) {
+            write_bytes(data, static_cast<size_t>(size));
+            checksum = crc32(data, static_cast<size_t>(size), checksum);
+            blockSize += size;
+            uint64_t pad = aligned(blockSize) - blockSize;
+            write_bytes(padding, static_cast<size_t>(pad));
+            checksum = crc32(padding, static_cast<size_t>(pad), checksum);
+            blockSize += pad;
+        };
+        write_array(&counts, sizeof(counts));
+        write_array(postingStarts.data(), postingStarts.size() * sizeof(uint64_t));
+        write_array(memberStarts.data(), memberStarts.size() * sizeof(uint64_t));
+        write_array(times.data(), times.size() * sizeof(TimeEntry));
+        write_array(postings.data(), postings.size() * sizeof(uint32_t));
+        write_array(members.data(), members.size() * sizeof(uint32_t));
+        write_array(live.data(), live.size() * sizeof(uint32_t));
+
+        IndexFooter footer = {};
+        copy(index_magic, index_magic + sizeof(footer.magic), footer.magic);
+        footer.offset = blockOffset;
+        footer.size = blockSize;
+        footer.version = index_version;
+        footer.checksum = checksum;
+        write_bytes(&footer, sizeof(footer));
+    }
+};
+
+// A copy of everything an image source presents to RecipeImage::write, so
+// the image can be written later on another thread while the book it came
+// from carries on changing. Ingredients are renumbered and their names
+// copied here, as the process-wide table is not safe to read while the
+// book's thread interns into it.
+class ImageSnapshot {
+private:
+    // Offset and length of a string in pool
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+
+    struct Row {
+        Span name;
+        int cookingTime;
+        CategoryId category;
+        RecipeKind kind;
+        uint32_t slot;
+        uint32_t firstIngredient;
+        uint32_t ingredientCount;
+        uint32_t firstStep;
+        uint32_t stepCount;
+    };
+
+    bool delta;
+    uint64_t checkpointNumber;
+    uint64_t logSequence;
+    string pool;
+    vector<Row> rows;
+    vector<IngredientId> ingredients;
+    vector<Span> steps;
+    vector<Span> ingredientNames;
+    CategoryId firstCategory;
+    vector<Span> categoryNames;
+    size_t slotCount;
+    vector<uint32_t> changedSlots;
+    vector<uint32_t> generations;
+    vector<uint32_t> freeSlots;
+
+    Span keep(string_view text) {
+        Span span = { pool.size(), text.size() };
+        pool.append(text.data(), text.size());
+        return span;
+    }
+
+    string_view text(const Span& span) const {
+        return string_view(pool.data() + span.offset, span.length);
+    }
+
+public:
+    template <typename Source>
+    explicit ImageSnapshot(const Source& source)
+        : delta(source.is_delta()), checkpointNumber(source.checkpoint()), logSequence(source.log_sequence()),
+          firstCategory(source.first_category()), slotCount(source.slot_count()) {
+        vector<IngredientId> localIds(source.ingredient_space(), IngredientTable::npos);
+        rows.reserve(source.size());
+        for (size_t i = 0; i < source.size(); ++i) {
+            Row row;
+            row.name = keep(source.name(i));
+            row.cookingTime = source.cooking_time(i);
+            row.category = source.category_id(i);
+            row.kind = source.kind(i);
+            row.slot = source.slot(i);
+            row.firstIngredient = static_cast<uint32_t>(ingredients.size());
+            source.for_each_ingredient(i, [&](IngredientId id) {
+                if (localIds[id] == IngredientTable::npos) {
+                    localIds[id] = static_cast<IngredientId>(ingredientNames.size());
+                    ingredientNames.push_back(keep(source.ingredient_name(id)));
+                }
+                ingredients.push_back(localIds[id]);
+            });
+            row.ingredientCount = static_cast<uint32_t>(ingredients.size()) - row.firstIngredient;
+            row.firstStep = static_cast<uint32_t>(steps.size());
+            row.stepCount = static_cast<uint32_t>(source.step_count(i));
+            for (size_t step = 0; step < row.stepCount; ++step) {
+                steps.push_back(keep(source.step(i, step)));
+            }
+            rows.push_back(row);
+        }
+
+        for (size_t i = 0; i < source.category_count(); ++i) {
+            categoryNames.push_back(keep(source.category_name(firstCategory + static_cast<CategoryId>(i))));
+        }
+        for (size_t i = 0; i < source.changed_slot_count(); ++i) {
+            changedSlots.push_back(source.changed_slot(i));
+        }
+        size_t generationCount = delta ? changedSlots.size() : slotCount;
+        generations.reserve(generationCount);
+        for (size_t i = 0; i < generationCount; ++i) {
+            generations.push_back(source.slot_generation(i));
+        }
+        ArrayView<uint32_t> free = source.free_slots();
+        freeSlots.assign(free.begin(), free.end());
+    }
+
+    // Write the snapshot to path through a temporary file, synced and
+    // renamed over path once complete, so a true return means it is on disk
+    bool write(const string& path) const {
+        string temporaryPath = path + ".tmp";
+        if (!RecipeImage::write(temporaryPath, *this) || !replace_file_durably(temporaryPath, path)) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // The source interface RecipeImage::write reads
+
+    bool is_delta() const {
+        return delta;
+    }
+
+    uint64_t checkpoint() const {
+        return checkpointNumber;
+    }
+
+    uint64_t log_sequence() const {
+        return logSequence;
+    }
+
+    size_t size() const {
+        return rows.size();
+    }
+
+    string_view name(size_t row) const {
+        return text(rows[row].name);
+    }
+
+    int cooking_time(size_t row) const {
+        return rows[row].cookingTime;
+    }
+
+    CategoryId category_id(size_t row) const {
+        return rows[row].category;
+    }
+
+    RecipeKind kind(size_t row) const {
+        return rows[row].kind;
+    }
+
+    uint32_t slot(size_t row) const {
+        return rows[row].slot;
+    }
+
+    size_t ingredient_count(size_t row) const {
+        return rows[row].ingredientCount;
+    }
+
+    template <typename Function>
+    void for_each_ingredient(size_t row, Function fn) const {
+        const Row& entry = rows[row];
+        for (uint32_t i = 0; i < entry.ingredientCount; ++i) {
+            fn(ingredients[entry.firstIngredient + i]);
+        }
+    }
+
+    size_t step_count(size_t row) const {
+        return rows[row].stepCount;
+    }
+
+    string_view step(size_t row, size_t i) const {
+        return text(steps[rows[row].firstStep + i]);
+    }
+
+    size_t ingredient_space() const {
+        return ingredientNames.size();
+    }
+
+    string_view ingredient_name(IngredientId id) const {
+        return text(ingredientNames[id]);
+    }
+
+    CategoryId first_category() const {
+        return firstCategory;
+    }
+
+    size_t category_count() const {
+        return categoryNames.size();
+    }
+
+    string_view category_name(CategoryId id) const {
+        return text(categoryNames[id - firstCategory]);
+    }
+
+    size_t slot_count() const {
+        return slotCount;
+    }
+
+    size_t changed_slot_count() const {
+        return changedSlots.size();
+    }
+
+    uint32_t changed_slot(size_t i) const {
+        return changedSlots[i];
+    }
+
+    uint32_t slot_generation(size_t i) const {
+        return generations[i];
+    }
+
+    ArrayView<uint32_t> free_slots() const {
+        return freeSlots;
+    }
+};
+
+// Append-only log of operations, each a checksummed record with a sequence
+// number. append() only buffers; a background thread writes and fsyncs
+// whatever has accumulated as one group, so a burst of appends costs a
+// single sync. Callers that must know a record is on disk wait for it with
+// wait_durable() or flush().
+class OperationLog {
+private:
+    struct RecordHeader {
+        uint32_t length;
+        // CRC-32 of the sequence number followed by the payload
+        uint32_t checksum;
+        uint64_t sequence;
+    };
+
+    // Anything longer is taken to be a damaged length field
+    static constexpr uint32_t max_record_size = 64 * 1024 * 1024;
+
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int file;
+#endif
+    string path;
+    chrono::milliseconds commitDelay;
+
+    mutex lock;
+    condition_variable wake;
+    condition_variable durable;
+    // Records appended but not yet handed to the writer
+    string pending;
+    uint64_t appendedSequence;
+    uint64_t durableSequence;
+    // Bytes of whole, synced records in the file
+    uint64_t fileLength;
+    bool stopping;
+    // A group failed to write. Later records could not be replayed past
+    // it, so they are dropped until reset() starts the log over.
+    bool failed;
+    // Whether the writer thread is up; waits return at once when it is not
+    bool running;
+    thread writer;
+
+    static uint32_t record_checksum(uint64_t sequence, const char* payload, size_t size) {
+        return crc32(payload, size, crc32(&sequence, sizeof(sequence)));
+    }
+
+    bool is_file_open() const {
+#ifdef _WIN32
+        return file != INVALID_HANDLE_VALUE;
+#else
+        return file >= 0;
+#endif
+    }
+
+    bool open_file() {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), FILE_APPEND_DATA | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+        file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+        return is_file_open();
+    }
+
+    void close_file() {
+        if (!is_file_open()) {
+            return;
+        }
+#ifdef _WIN32
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        ::close(file);
+        file = -1;
+#endif
+    }
+
+    bool write_file(const string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+#ifdef _WIN32
+            DWORD chunk = static_cast<DWORD>(min<size_t>(data.size() - done, 1 << 30));
+            DWORD wrote = 0;
+            if (!WriteFile(file, data.data() + done, chunk, &wrote, nullptr)) {
+                return false;
+            }
+#else
+            ssize_t wrote = ::write(file, data.data() + done, data.size() - done);
+            if (wrote < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+#endif
+            done += static_cast<size_t>(wrote);
+        }
+        return true;
+    }
+
+    bool sync_file() {
+#ifdef _WIN32
+        return FlushFileBuffers(file) != 0;
+#else
+        return fsync(file) == 0;
+#endif
+    }
+
+    bool truncate_file(uint64_t length) {
+#ifdef _WIN32
+        LARGE_INTEGER position;
+        position.QuadPart = static_cast<LONGLONG>(length);
+        return SetFilePointerEx(file, position, nullptr, FILE_BEGIN) && SetEndOfFile(file) && FlushFileBuffers(file);
+#else
+        return ftruncate(file, static_cast<off_t>(length)) == 0 && fsync(file) == 0;
+#endif
+    }
+
+    // Writer thread: wait for records, give other appends commitDelay to
+    // join the group, then write and sync the group as a whole
+    void run_writer() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            wake.wait(guard, [this]() { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            if (!stopping) {
+                wake.wait_for(guard, commitDelay, [this]() { return stopping; });
+            }
+
+            string group;
+            group.swap(pending);
+            uint64_t groupEnd = appendedSequence;
+            if (failed) {
+                continue;
+            }
+            guard.unlock();
+            bool written = write_file(group) && sync_file();
+            if (!written) {
+                // Cut off whatever part of the group reached the file, so
+                // the log still ends on a whole record
+                truncate_file(fileLength);
+            }
+            guard.lock();
+
+            if (written) {
+                fileLength += group.size();
+                durableSequence = groupEnd;
+            }
+            else {
+                failed = true;
+            }
+            durable.notify_all();
+        }
+    }
+
+    // Read the log at path from the start, calling fn(sequence, payload) for
+    // each intact record. Stops at the first record that is cut short or
+    // fails its checksum, which is where a crash interrupted the last group.
+    // Returns the length of the intact prefix.
+    template <typename Function>
+    static uint64_t scan(const string& path, Function fn) {
+        ifstream in(path, ios::binary);
+        uint64_t intact = 0;
+        RecordHeader header;
+        string payload;
+        while (in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            if (header.length > max_record_size) {
+                break;
+            }
+            payload.resize(header.length);
+            if (!in.read(&payload[0], header.length) || record_checksum(header.sequence, payload.data(), payload.size()) != header.checksum) {
+                break;
+            }
+            fn(header.sequence, string_view(payload));
+            intact += sizeof(header) + header.length;
+        }
+        return intact;
+    }
+
+public:
+    explicit OperationLog(chrono::milliseconds delay = chrono::milliseconds(20))
+#ifdef _WIN32
+        : file(INVALID_HANDLE_VALUE),
+#else
+        : file(-1),
+#endif
+        commitDelay(delay), appendedSequence(0), durableSequence(0), fileLength(0), stopping(false), failed(false), running(false) {}
+
+    OperationLog(const OperationLog&) = delete;
+    OperationLog& operator=(const OperationLog&) = delete;
+
+    ~OperationLog() {
+        close();
+    }
+
+    // Open or create the log at logPath and start the writer. A damaged tail
+    // left by a crash is cut off so new records follow the intact ones.
+    bool open(const string& logPath) {
+        close();
+        path = logPath;
+        uint64_t lastSequence = 0;
+        uint64_t intact = scan(path, [&lastSequence](uint64_t sequence, string_view) { lastSequence = sequence; });
+        if (!open_file() || !truncate_file(intact)) {
+            close_file();
+            return false;
+        }
+
+        appendedSequence = lastSequence;
+        durableSequence = lastSequence;
+        fileLength = intact;
+        stopping = false;
+        failed = false;
+        running = true;
+        writer = thread(&OperationLog::run_writer, this);
+        return true;
+    }
+
+    // Write out everything appended so far and stop the writer
+    void close() {
+        if (writer.joinable()) {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+            {
+                lock_guard<mutex> guard(lock);
+                running = false;
+            }
+            durable.notify_all();
+        }
+        close_file();
+    }
+
+    // Call fn(sequence, payload) for every record in the log, oldest first.
+    // Meant for recovery, before anything new is appended.
+    template <typename Function>
+    void replay(Function fn) const {
+        scan(path, fn);
+    }
+
+    // Queue a record, returning its sequence number
+    uint64_t append(string_view payload) {
+        RecordHeader header;
+        header.length = static_cast<uint32_t>(payload.size());
+        {
+            lock_guard<mutex> guard(lock);
+            header.sequence = ++appendedSequence;
+            header.checksum = record_checksum(header.sequence, payload.data(), payload.size());
+            pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            pending.append(payload.data(), payload.size());
+        }
+        wake.notify_one();
+        return header.sequence;
+    }
+
+    // Block until the record with this sequence number is on disk. Returns
+    // false if a write has failed.
+    bool wait_durable(uint64_t sequence) {
+        unique_lock<mutex> guard(lock);
+        durable.wait(guard, [&]() { return durableSequence >= sequence || failed || !running; });
+        return durableSequence >= sequence && !failed;
+    }
+
+    bool flush() {
+        uint64_t sequence;
+        {
+            lock_guard<mutex> guard(lock);
+            sequence = appendedSequence;
+        }
+        return wait_durable(sequence);
+    }
+
+    // Continue numbering after sequence, so new records sort after ones a
+    // checkpoint has already absorbed
+    void skip_to(uint64_t sequence) {
+        lock_guard<mutex> guard(lock);
+        if (appendedSequence < sequence) {
+            appendedSequence = sequence;
+            durableSequence = sequence;
+        }
+    }
+
+    // Empty the log once a checkpoint holds everything in it. Numbering
+    // carries on from where it was. As the checkpoint also holds any records
+    // dropped after a failed write, the log is usable again afterwards.
+    bool reset() {
+        unique_lock<mutex> guard(lock);
+        durable.wait(guard, [this]() { return durableSequence >= appendedSequence || failed || !running; });
+        if (!running || !truncate_file(0)) {
+            return false;
+        }
+        pending.clear();
+        fileLength = 0;
+        durableSequence = appendedSequence;
+        failed = false;
+        return true;
+    }
+
+    uint64_t last_sequence() {
+        lock_guard<mutex> guard(lock);
+        return appendedSequence;
+    }
+};
+
+// Least-recently-used cache of up to capacity values by key. Values are held
+// by shared_ptr, so one evicted while still in use lives on until released.
+template <typename Key, typename Value>
+class LruCache {
+private:
+    using Entry = pair<Key, shared_ptr<const Value>>;
+    // Most recently used first
+    list<Entry> entries;
+    unordered_map<Key, typename list<Entry>::iterator> positions;
+    size_t capacity;
+
+    void evict() {
+        while (entries.size() > capacity) {
+            positions.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+public:
+    explicit LruCache(size_t maxEntries) : capacity(max<size_t>(maxEntries, 1)) {}
+
+    // The value for key, marked most recently used, or nullptr
+    shared_ptr<const Value> find(const Key& key) {
+        auto it = positions.find(key);
+        if (it == positions.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void insert(const Key& key, shared_ptr<const Value> value) {
+        erase(key);
+        entries.emplace_front(key, std::move(value));
+        positions[key] = entries.begin();
+        evict();
+    }
+
+    void erase(const Key& key) {
+        auto it = positions.find(key);
+        if (it != positions.end()) {
+            entries.erase(it->second);
+            positions.erase(it);
+        }
+    }
+
+    void clear() {
+        entries.clear();
+        positions.clear();
+    }
+
+    void set_capacity(size_t maxEntries) {
+        capacity = max<size_t>(maxEntries, 1);
+        evict();
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+};
+
+// Full-text index over recipe names and steps, ranked by BM25. Words are
+// runs of letters and digits compared without ASCII case; bytes above 127
+// count as letters, so UTF-8 words stay whole. Each word's postings are
+// (document, frequency) pairs, delta- and varint-encoded in blocks of
+// block_size. A block records the highest frequency and shortest document
+// in it, which bound the score of anything inside, so a search skips the
+// blocks and documents that cannot reach its current top k.
+//
+// Documents are numbered in the order they are added. A removed one is only
+// marked dead until the dead outnumber the living, when the postings are
+// rewritten without them; until then they still count towards document
+// frequencies and the average length.
+class TextIndex {
+public:
+    static constexpr size_t block_size = 128;
+
+    struct Hit {
+        uint32_t slot;
+        float score;
+    };
+
+private:
+    static constexpr uint32_t no_document = UINT32_MAX;
+    // BM25 term frequency saturation and length normalisation
+    static constexpr float k1 = 1.2f;
+    static constexpr float b = 0.75f;
+
+    struct Block {
+        uint32_t firstDocument;
+        uint32_t lastDocument;
+        // Start of the block's entries in PostingList::bytes
+        uint32_t offset;
+        uint32_t count;
+        uint32_t maxFrequency;
+        uint32_t minLength;
+    };
+
+    struct PostingList {
+        vector<uint8_t> bytes;
+        vector<Block> blocks;
+        uint32_t documentCount;
+        uint32_t maxFrequency;
+        uint32_t minLength;
+
+        PostingList() : documentCount(0), maxFrequency(0), minLength(UINT32_MAX) {}
+    };
+
+    // Position in one word's postings during a search, with the current
+    // block decoded
+    struct Cursor {
+        const PostingList* list;
+        float idf;
+        // Most the word can add to any document's score
+        float upperBound;
+        uint32_t document;
+        size_t block;
+        // Block that block_bound last looked at; never behind block
+        size_t shallowBlock;
+        uint32_t position;
+        // Entries decoded from block, or 0 when it has not been decoded
+        uint32_t count;
+        uint32_t documents[block_size];
+        uint32_t frequencies[block_size];
+    };
+
+    unordered_map<string, uint32_t> termIds;
+    vector<PostingList> postings;
+
+    // Per document: the slot it describes, its length in words and whether
+    // it is still live
+    vector<uint32_t> documentSlots;
+    vector<uint32_t> documentLengths;
+    vector<uint8_t> documentLive;
+    // Document of each slot, or no_document
+    vector<uint32_t> slotDocuments;
+    uint64_t totalLength;
+    size_t deadCount;
+
+    // (term, frequency) of the document being added, and the word being read
+    vector<pair<uint32_t, uint32_t>> documentTerms;
+    string word;
+
+    static bool is_word_byte(unsigned char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+    }
+
+    // Call fn with each word of text, lowercased, using word as scratch
+    template <typename Function>
+    static void for_each_word(string_view text, string& word, Function fn) {
+        size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && !is_word_byte(static_cast<unsigned char>(text[i]))) {
+                ++i;
+            }
+            word.clear();
+            while (i < text.size() && is_word_byte(static_cast<unsigned char>(text[i]))) {
+                char c = text[i++];
+                word.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+            }
+            if (!word.empty()) {
+                fn(word);
+            }
+        }
+    }
+
+    static void put_varint(vector<uint8_t>& bytes, uint32_t value) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(value));
+    }
+
+    static uint32_t get_varint(const uint8_t*& p) {
+        uint32_t value = 0;
+        int shift = 0;
+        while (*p & 0x80) {
+            value |= static_cast<uint32_t>(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        value |= static_cast<uint32_t>(*p++) << shift;
+        return value;
+    }
+
+    // Documents must be appended to a list in increasing order
+    static void append(PostingList& list, uint32_t document, uint32_t frequency, uint32_t length) {
+        if (list.blocks.empty() || list.blocks.back().count == block_size) {
+            list.blocks.push_back(Block{ document, document, static_cast<uint32_t>(list.bytes.size()), 0, 0, UINT32_MAX });
+        }
+        Block& block = list.blocks.back();
+        // The first entry of a block stores a gap of zero from firstDocument
+        put_varint(list.bytes, document - block.lastDocument);
+        put_varint(list.bytes, frequency);
+        block.lastDocument = document;
+        ++block.count;
+        block.maxFrequency = max(block.maxFrequency, frequency);
+        block.minLength = min(block.minLength, length);
+
+        ++list.documentCount;
+        list.maxFrequency = max(list.maxFrequency, frequency);
+        list.minLength = min(list.minLength, length);
+    }
+
+    // Decode block i of list, returning its entry count
+    static uint32_t decode_block(const PostingList& list, size_t i, uint32_t* documents, uint32_t* frequencies) {
+        const Block& block = list.blocks[i];
+        const uint8_t* p = list.bytes.data() + block.offset;
+        uint32_t document = block.firstDocument;
+        for (uint32_t j = 0; j < block.count; ++j) {
+            document += get_varint(p);
+            documents[j] = document;
+            frequencies[j] = get_varint(p);
+        }
+        return block.count;
+    }
+
+    static float term_score(float idf, uint32_t frequency, uint32_t length, float averageLength) {
+        float f = static_cast<float>(frequency);
+        return idf * f * (k1 + 1) / (f + k1 * (1 - b + b * static_cast<float>(length) / averageLength));
+    }
+
+    // Move to the first entry at or after target
+    static void seek(Cursor& cursor, uint32_t target) {
+        if (cursor.document >= target) {
+            return;
+        }
+        const vector<Block>& blocks = cursor.list->blocks;
+        while (cursor.block < blocks.size() && blocks[cursor.block].lastDocument < target) {
+            ++cursor.block;
+            cursor.count = 0;
+        }
+        if (cursor.block == blocks.size()) {
+            cursor.document = no_document;
+            return;
+        }
+        if (cursor.count == 0) {
+            cursor.count = decode_block(*cursor.list, cursor.block, cursor.documents, cursor.frequencies);
+            cursor.position = 0;
+        }
+        // The block ends at or after target, so this stops inside it
+        while (cursor.documents[cursor.position] < target) {
+            ++cursor.position;
+        }
+        cursor.document = cursor.documents[cursor.position];
+    }
+
+    // Most the cursor's word can add to document, from the block that would
+    // hold it, without decoding anything. Documents only increase between
+    // calls.
+    float block_bound(Cursor& cursor, uint32_t document, float averageLength) const {
+        const vector<Block>& blocks = cursor.list->blocks;
+        size_t& i = cursor.shallowBlock;
+        i = max(i, cursor.block);
+        while (i < blocks.size() && blocks[i].lastDocument < document) {
+            ++i;
+        }
+        if (i == blocks.size() || blocks[i].firstDocument > document) {
+            return 0;
+        }
+        return term_score(cursor.idf, blocks[i].maxFrequency, blocks[i].minLength, averageLength);
+    }
+
+    // Rewrite the postings without dead documents, renumbering the rest in
+    // the same order
+    void compact() {
+        vector<uint32_t> renumbered(documentSlots.size(), no_document);
+        vector<uint32_t> keptSlots;
+        vector<uint32_t> keptLengths;
+        keptSlots.reserve(documentSlots.size() - deadCount);
+        keptLengths.reserve(documentSlots.size() - deadCount);
+        totalLength = 0;
+        for (uint32_t document = 0; document < documentSlots.size(); ++document) {
+            if (documentLive[document]) {
+                renumbered[document] = static_cast<uint32_t>(keptSlots.size());
+                slotDocuments[documentSlots[document]] = renumbered[document];
+                keptSlots.push_back(documentSlots[document]);
+                keptLengths.push_back(documentLengths[document]);
+                totalLength += documentLengths[document];
+            }
+        }
+
+        // Each word's postings are rewritten independently
+        parallel_for(postings.size(), [&](size_t term) {
+            PostingList& list = postings[term];
+            PostingList kept;
+            uint32_t documents[block_size];
+            uint32_t frequencies[block_size];
+            for (size_t i = 0; i < list.blocks.size(); ++i) {
+                uint32_t count = decode_block(list, i, documents, frequencies);
+                for (uint32_t j = 0; j < count; ++j) {
+                    uint32_t document = renumbered[documents[j]];
+                    if (document != no_document) {
+                        append(kept, document, frequencies[j], keptLengths[document]);
+                    }
+                }
+            }
+            list = std::move(kept);
+        });
+
+        documentSlots.swap(keptSlots);
+        documentLengths.swap(keptLengths);
+        documentLive.assign(documentSlots.size(), 1);
+        deadCount = 0;
+    }
+
+public:
+    TextIndex() : totalLength(0), deadCount(0) {}
+
+    // Index the text that texts passes to the function it is given, as in
+    // [&](auto add) { add(name); add(step); }, as the document for slot,
+    // replacing any the slot already has
+    template <typename Function>
+    void add(uint32_t slot, Function texts) {
+        remove(slot);
+        const uint32_t document = static_cast<uint32_t>(documentSlots.size());
+        uint32_t length = 0;
+        documentTerms.clear();
+        texts([&](string_view text) {
+            for_each_word(text, word, [&](const string& found) {
+                ++length;
+                auto it = termIds.find(found);
+                if (it == termIds.end()) {
+                    it = termIds.emplace(found, static_cast<uint32_t>(postings.size())).first;
+                    postings.emplace_back();
+                }
+                documentTerms.emplace_back(it->second, 1);
+            });
+        });
+
+        // Count repeated words, then post each once
+        sort(documentTerms.begin(), documentTerms.end());
+        for (size_t i = 0; i < documentTerms.size();) {
+            size_t end = i + 1;
+            while (end < documentTerms.size() && documentTerms[end].first == documentTerms[i].first) {
+                ++end;
+            }
+            append(postings[documentTerms[i].first], document, static_cast<uint32_t>(end - i), length);
+            i = end;
+        }
+
+        documentSlots.push_back(slot);
+        documentLengths.push_back(length);
+        documentLive.push_back(1);
+        if (slot >= slotDocuments.size()) {
+            slotDocuments.resize(slot + 1, no_document);
+        }
+        slotDocuments[slot] = document;
+        totalLength += length;
+    }
+
+    // Drop the slot's document, if it has one
+    void remove(uint32_t slot) {
+        if (slot >= slotDocuments.size() || slotDocuments[slot] == no_document) {
+            return;
+        }
+        documentLive[slotDocuments[slot]] = 0;
+        slotDocuments[slot] = no_document;
+        ++deadCount;
+        if (deadCount > block_size && deadCount > documentSlots.size() - deadCount) {
+            compact();
+        }
+    }
+
+    // Number of live documents
+    size_t size() const {
+        return documentSlots.size() - deadCount;
+    }
+
+    // The k documents that score highest for the words of query, best first;
+    // equal scores keep the order the documents were added in. Evaluated a
+    // document at a time in the MaxScore style: words are ordered by the
+    // most they can add, the least valuable only checked for documents the
+    // others have already made competitive, and block maxima rule out
+    // documents before any of their postings are decoded.
+    vector<Hit> search(string_view query, size_t k) const {
+        vector<Hit> hits;
+        if (k == 0 || size() == 0) {
+            return hits;
+        }
+
+        vector<uint32_t> terms;
+        string scratch;
+        for_each_word(query, scratch, [&](const string& found) {
+            auto it = termIds.find(found);
+            if (it != termIds.end() && postings[it->second].documentCount != 0) {
+                terms.push_back(it->second);
+            }
+        });
+        sort(terms.begin(), terms.end());
+        terms.erase(unique(terms.begin(), terms.end()), terms.end());
+        if (terms.empty()) {
+            return hits;
+        }
+
+        const float documentCount = static_cast<float>(documentSlots.size());
+        const float averageLength = max(1.0f, static_cast<float>(totalLength) / documentCount);
+        vector<Cursor> cursors(terms.size());
+        for (size_t i = 0; i < terms.size(); ++i) {
+            const PostingList& list = postings[terms[i]];
+            Cursor& cursor = cursors[i];
+            float frequency = static_cast<float>(list.documentCount);
+            cursor.list = &list;
+            cursor.idf = log(1 + (documentCount - frequency + 0.5f) / (frequency + 0.5f));
+            cursor.upperBound = term_score(cursor.idf, list.maxFrequency, list.minLength, averageLength);
+            cursor.block = 0;
+            cursor.shallowBlock = 0;
+            cursor.position = 0;
+            cursor.count = decode_block(list, 0, cursor.documents, cursor.frequencies);
+            cursor.document = cursor.documents[0];
+        }
+        sort(cursors.begin(), cursors.end(), [](const Cursor& a, const Cursor& b) { return a.upperBound < b.upperBound; });
+
+        // bounds[i]: the most words 0..i together can add
+        const size_t n = cursors.size();
+        vector<float> bounds(n);
+        float sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += cursors[i].upperBound;
+            bounds[i] = sum;
+        }
+
+        // The best k so far as (score, document), kept as a heap with the
+        // weakest on top
+        auto better = [](const pair<float, uint32_t>& a, const pair<float, uint32_t>& b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        };
+        vector<pair<float, uint32_t>> best;
+        best.reserve(k + 1);
+        float threshold = 0;
+        // Each word's part in the score of the document being scored
+        vector<float> contributions(n);
+
+        // Words before firstEssential cannot put a document in the top k on
+        // their own, so only the others propose candidates
+        size_t firstEssential = 0;
+        while (true) {
+            if (best.size() == k) {
+                while (firstEssential < n && bounds[firstEssential] <= threshold) {
+                    ++firstEssential;
+                }
+            }
+            if (firstEssential == n) {
+                break;
+            }
+            uint32_t document = no_document;
+            for (size_t i = firstEssential; i < n; ++i) {
+                document = min(document, cursors[i].document);
+            }
+            if (document == no_document) {
+                break;
+            }
+
+            bool candidate = documentLive[document] != 0;
+            if (candidate && best.size() == k) {
+                float bound = 0;
+                for (Cursor& cursor : cursors) {
+                    bound += block_bound(cursor, document, averageLength);
+                }
+                candidate = bound > threshold;
+            }
+
+            float score = 0;
+            const uint32_t length = documentLengths[document];
+            if (candidate) {
+                fill(contributions.begin(), contributions.end(), 0.0f);
+                for (size_t i = firstEssential; i < n; ++i) {
+                    const Cursor& cursor = cursors[i];
+                    if (cursor.document == document) {
+                        contributions[i] = term_score(cursor.idf, cursor.frequencies[cursor.position], length, averageLength);
+                        score += contributions[i];
+                    }
+                }
+                // The rest, most valuable first, while they could still lift
+                // the document into the top k
+                for (size_t i = firstEssential; i-- > 0;) {
+                    if (best.size() == k && score + bounds[i] <= threshold) {
+                        candidate = false;
+                        break;
+                    }
+                    Cursor& cursor = cursors[i];
+                    seek(cursor, document);
+                    if (cursor.document == document) {
+                        contributions[i] = term_score(cursor.idf, cursor.frequencies[cursor.position], length, averageLength);
+                        score += contributions[i];
+                    }
+                }
+                // Sum in a fixed order, so a score does not depend on how
+                // far pruning had got and equal documents tie exactly
+                score = 0;
+                for (float contribution : contributions) {
+                    score += contribution;
+                }
+            }
+            for (size_t i = firstEssential; i < n; ++i) {
+                if (cursors[i].document == document) {
+                    seek(cursors[i], document + 1);
+                }
+            }
+
+            // Documents come in increasing order, so a later one only
+            // displaces an equal score if it beats it outright
+            if (candidate && (best.size() < k || score > threshold)) {
+                best.emplace_back(score, document);
+                push_heap(best.begin(), best.end(), better);
+                if (best.size() > k) {
+                    pop_heap(best.begin(), best.end(), better);
+                    best.pop_back();
+                }
+                if (best.size() == k) {
+                    threshold = best.front().first;
+                }
+            }
+        }
+
+        sort(best.begin(), best.end(), better);
+        hits.reserve(best.size());
+        for (const auto& entry : best) {
+            hits.push_back(Hit{ documentSlots[entry.second], entry.first });
+        }
+        return hits;
+    }
+};
+
+// Finds ingredient names within a few edits of what was typed, ignoring
+// ASCII case. Names are indexed by their trigrams, padded so the ends of a
+// name count too. An edit touches at most three trigrams, so a name within
+// k edits shares all but 3k of the query's distinct trigrams; only names
+// that pass that count and the length difference are compared in full,
+// with an edit distance cut off once it passes k. Queries too short for the
+// count to rule anything out look only at names of a suitable length.
+class FuzzyMatcher {
+public:
+    struct Match {
+        IngredientId id;
+        uint32_t distance;
+    };
+
+private:
+    // Trigram to the IDs of the names containing it, in increasing order
+    unordered_map<uint32_t, vector<IngredientId>> postings;
+    // Lowercased names and the IDs of the names of each length
+    vector<string> names;
+    vector<vector<IngredientId>> byLength;
+    // Shared trigram counts per name during find, and the names touched
+    vector<uint16_t> counts;
+    vector<IngredientId> touched;
+
+    static string lowercase(string_view text) {
+        string result(text);
+        for (char& c : result) {
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+        }
+        return result;
+    }
+
+    // Distinct trigrams of text padded with two NULs at each end
+    static vector<uint32_t> trigrams(const string& text) {
+        string padded(2, '\0');
+        padded += text;
+        padded.append(2, '\0');
+        vector<uint32_t> grams;
+        grams.reserve(padded.size() - 2);
+        for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+            grams.push_back(static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16 |
+                            static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8 |
+                            static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 2])));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    // Levenshtein distance of a and b, or limit + 1 once it must exceed limit
+    static uint32_t bounded_distance(const string& a, const string& b, uint32_t limit) {
+        const size_t m = a.size();
+        const size_t n = b.size();
+        if ((m > n ? m - n : n - m) > limit) {
+            return limit + 1;
+        }
+        vector<uint32_t> previous(n + 1);
+        vector<uint32_t> current(n + 1);
+        for (size_t j = 0; j <= n; ++j) {
+            previous[j] = static_cast<uint32_t>(j);
+        }
+        for (size_t i = 1; i <= m; ++i) {
+            current[0] = static_cast<uint32_t>(i);
+            uint32_t rowMinimum = current[0];
+            for (size_t j = 1; j <= n; ++j) {
+                uint32_t substitution = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+                current[j] = min(substitution, min(previous[j], current[j - 1]) + 1);
+                rowMinimum = min(rowMinimum, current[j]);
+            }
+            if (rowMinimum > limit) {
+                return limit + 1;
+            }
+            previous.swap(current);
+        }
+        return min(previous[n], limit + 1);
+    }
+
+public:
+    // Index the names the table has gained since the last call
+    void update(const IngredientTable& table) {
+        for (IngredientId id = static_cast<IngredientId>(names.size()); id < table.size(); ++id) {
+            names.push_back(lowercase(table.name_view(id)));
+            const string& name = names.back();
+            for (uint32_t gram : trigrams(name)) {
+                postings[gram].push_back(id);
+            }
+            if (name.size() >= byLength.size()) {
+                byLength.resize(name.size() + 1);
+            }
+            byLength[name.size()].push_back(id);
+        }
+        counts.resize(names.size(), 0);
+    }
+
+    // Indexed names within maxDistance edits of typed, closest first, then
+    // by ID
+    vector<Match> find(string_view typed, uint32_t maxDistance) {
+        const string query = lowercase(typed);
+        const size_t shortest = query.size() > maxDistance ? query.size() - maxDistance : 0;
+        const size_t longest = query.size() + maxDistance;
+        vector<Match> matches;
+        auto consider = [&](IngredientId id) {
+            uint32_t distance = bounded_distance(query, names[id], maxDistance);
+            if (distance <= maxDistance) {
+                matches.push_back(Match{ id, distance });
+            }
+        };
+
+        const vector<uint32_t> grams = trigrams(query);
+        const size_t destroyed = 3 * static_cast<size_t>(maxDistance);
+        if (grams.size() <= destroyed) {
+            for (size_t length = shortest; length <= longest && length < byLength.size(); ++length) {
+                for (IngredientId id : byLength[length]) {
+                    consider(id);
+                }
+            }
+        }
+        else {
+            const size_t needed = grams.size() - destroyed;
+            for (uint32_t gram : grams) {
+                auto it = postings.find(gram);
+                if (it == postings.end()) {
+                    continue;
+                }
+                for (IngredientId id : it->second) {
+                    if (counts[id]++ == 0) {
+                        touched.push_back(id);
+                    }
+                }
+            }
+            for (IngredientId id : touched) {
+                if (counts[id] >= needed && names[id].size() >= shortest && names[id].size() <= longest) {
+                    consider(id);
+                }
+                counts[id] = 0;
+            }
+            touched.clear();
+        }
+
+        sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.id < b.id;
+        });
+        return matches;
+    }
+};
+
+// Ingredient conditions for RecipeBook::search_recipes: every ingredient in
+// allOf, at least one in anyOf (when it is not empty) and none in noneOf
+struct IngredientQuery {
+    vector<string> allOf;
+    vector<string> anyOf;
+    vector<string> noneOf;
+};
+
+// Conditions for RecipeBook::run_query, all of which a recipe must meet,
+// parsed from text such as
+//     ingredient:eggs AND time<30 AND category:Italian
+// A condition is ingredient:<name> or category:<name>, optionally preceded
+// by NOT, or time compared with <, <=, =, >= or > to a number of minutes.
+// Names containing spaces go in double quotes. Keywords and field names
+// ignore case; names are matched exactly.
+struct RecipeQuery {
+    struct NameCondition {
+        string name;
+        bool negated;
+    };
+
+    vector<NameCondition> ingredients;
+    vector<NameCondition> categories;
+    // Cooking time range, inclusive
+    int minMinutes;
+    int maxMinutes;
+
+    RecipeQuery() : minMinutes(INT_MIN), maxMinutes(INT_MAX) {}
+
+    bool restricts_time() const {
+        return minMinutes != INT_MIN || maxMinutes != INT_MAX;
+    }
+
+    // Parse text into query. On failure returns false and, if error is
+    // given, describes the problem and where it is.
+    static bool parse(string_view text, RecipeQuery& query, string* error = nullptr) {
+        query = RecipeQuery();
+        Lexer lexer(text);
+        do {
+            if (!parse_condition(lexer, query)) {
+                if (error != nullptr) {
+                    *error = "expected a condition at position " + to_string(lexer.position);
+                }
+                return false;
+            }
+        } while (lexer.keyword("AND"));
+
+        lexer.skip_spaces();
+        if (!lexer.at_end()) {
+            if (error != nullptr) {
+                *error = "expected AND at position " + to_string(lexer.position);
+            }
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Lexer {
+        string_view text;
+        size_t position;
+
+        explicit Lexer(string_view source) : text(source), position(0) {}
+
+        void skip_spaces() {
+            while (position < text.size() && isspace(static_cast<unsigned char>(text[position]))) {
+                ++position;
+            }
+        }
+
+        bool at_end() const {
+            return position == text.size();
+        }
+
+        // Consume word, ignoring case, if it comes next as a whole word
+        bool keyword(string_view word) {
+            skip_spaces();
+            if (text.size() - position < word.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < word.size(); ++i) {
+                if (tolower(static_cast<unsigned char>(text[position + i])) != tolower(static_cast<unsigned char>(word[i]))) {
+                    return false;
+                }
+            }
+            size_t end = position + word.size();
+            if (end < text.size() && isalnum(static_cast<unsigned char>(text[end]))) {
+                return false;
+            }
+            position = end;
+            return true;
+        }
+
+        bool symbol(string_view symbol) {
+            skip_spaces();
+            if (text.substr(position, symbol.size()) != symbol) {
+                return false;
+            }
+            position += symbol.size();
+            return true;
+        }
+
+        // A double-quoted string or a run of anything but spaces
+        bool value(string& result) {
+            skip_spaces();
+            if (at_end()) {
+                return false;
+            }
+            if (text[position] == '"') {
+                size_t close = text.find('"', position + 1);
+                if (close == string_view::npos) {
+                    return false;
+                }
+                result.assign(text.substr(position + 1, close - position - 1));
+                position = close + 1;
+                return true;
+            }
+            size_t start = position;
+            while (position < text.size() && !isspace(static_cast<unsigned char>(text[position]))) {
+                ++position;
+            }
+            result.assign(text.substr(start, position - start));
+            return true;
+        }
+
+        bool number(int& result) {
+            skip_spaces();
+            size_t start = position;
+            if (position < text.size() && text[position] == '-') {
+                ++position;
+            }
+            long long parsed = 0;
+            size_t digits = 0;
+            while (position < text.size() && isdigit(static_cast<unsigned char>(text[position])) && parsed < INT_MAX) {
+                parsed = parsed * 10 + (text[position++] - '0');
+                ++digits;
+            }
+            if (digits == 0 || parsed >= INT_MAX || (position < text.size() && isalnum(static_cast<unsigned char>(text[position])))) {
+                position = start;
+                return false;
+            }
+            result = static_cast<int>(text[start] == '-' ? -parsed : parsed);
+            return true;
+        }
+    };
+
+    static bool parse_condition(Lexer& lexer, RecipeQuery& query) {
+        bool negated = lexer.keyword("NOT");
+        vector<NameCondition>* conditions = nullptr;
+        if (lexer.keyword("ingredient")) {
+            conditions = &query.ingredients;
+        }
+        else if (lexer.keyword("category")) {
+            conditions = &query.categories;
+        }
+        if (conditions != nullptr) {
+            string name;
+            if (!lexer.symbol(":") || !lexer.value(name) || name.empty()) {
+                return false;
+            }
+            conditions->push_back(NameCondition{ name, negated });
+            return true;
+        }
+
+        if (negated || !lexer.keyword("time")) {
+            return false;
+        }
+        // Two-character operators first, so "<=" is not read as "<"
+        static const string_view operators[] = { "<=", ">=", "<", ">", "=" };
+        string_view op;
+        for (string_view candidate : operators) {
+            if (lexer.symbol(candidate)) {
+                op = candidate;
+                break;
+            }
+        }
+        int minutes = 0;
+        if (op.empty() || !lexer.number(minutes)) {
+            return false;
+        }
+
+        // number() stays strictly inside the int range, so these cannot overflow
+        if (op == "<" || op == "<=" || op == "=") {
+            query.maxMinutes = min(query.maxMinutes, op == "<" ? minutes - 1 : minutes);
+        }
+        if (op == ">" || op == ">=" || op == "=") {
+            query.minMinutes = max(query.minMinutes, op == ">" ? minutes + 1 : minutes);
+        }
+        return true;
+    }
+};
+
+// Order of the recipes in a RecipePage: by slot, which is stable but
+// otherwise arbitrary, or fastest first with ties in slot order
+enum class PageOrder : uint8_t {
+    Slot,
+    CookingTime
+};
+
+// Where a page of results ended. Passing it back resumes after the last
+// recipe returned, by its place in the page order rather than by position
+// in a result list, so additions and deletions in between never repeat or
+// skip a recipe that was already there. Recipes added since may or may not
+// show up, depending on where they fall.
+struct PageCursor {
+    // Order key of the last recipe returned
+    int minutes;
+    uint32_t slot;
+    // False for the first page
+    bool started;
+
+    PageCursor() : minutes(INT_MIN), slot(0), started(false) {}
+};
+
+struct RecipePage {
+    vector<Recipe*> recipes;
+    // Cursor for the page after this one
+    PageCursor next;
+    // Whether there are more results after this page
+    bool more;
+};
+
+// A recipe found by RecipeBook::recipes_from_pantry
+struct PantryMatch {
+    Recipe* recipe;
+    // Ingredients of the recipe the pantry lacks, out of ingredientCount
+    uint32_t missing;
+    uint32_t ingredientCount;
+};
+
+// Recipe book class to manage recipes
+class RecipeBook {
+private:
+    // Recipes packed densely; getRecipes() order changes as recipes are removed
+    vector<Recipe*> recipes;
+    CategoryIndex categories;
+
+    // Slot map behind RecipeHandle: a handle's index selects a slot, which
+    // records the generation a live handle must carry and where the recipe
+    // sits in each container, so removing it never has to search
+    struct Slot {
+        uint32_t denseIndex;
+        uint32_t generation;
+        // Position in its category's member list, when it has a category
+        uint32_t categoryPosition;
+    };
+    vector<Slot> slots;
+    vector<uint32_t> freeSlots;
+
+    // Optional arena that backs recipes created through emplace_recipe, and
+    // the pool over it that recipes allocate from. The pool takes back what
+    // deleted recipes and replaced strings and vectors free, so churn reuses
+    // memory instead of growing the arena.
+    unique_ptr<pmr::monotonic_buffer_resource> arena;
+    unique_ptr<pmr::unsynchronized_pool_resource> pool;
+
+    // Columnar mirror of recipes used by the filter functions
+    RecipeStore store;
+
+    // Inverted index from ingredient ID to the slots of the recipes that use it
+    vector<RecipeBitmap> ingredientIndex;
+
+    // Slots of every live recipe, the starting set for exclusion-only queries
+    RecipeBitmap liveRecipes;
+
+    // Ordered index of (cooking time, slot) for range and fastest-first queries
+    set<pair<int, uint32_t>> cookingTimeIndex;
+
+    // Image that lazily loaded recipes read their steps from, the image row
+    // of each such recipe's slot (no_body_row for recipes that hold their
+    // own), and the most recently read bodies
+    static constexpr uint32_t no_body_row = UINT32_MAX;
+    static constexpr size_t default_body_cache = 256;
+    unique_ptr<RecipeImage> bodyImage;
+    vector<uint32_t> bodyRows;
+    mutable LruCache<uint32_t, Recipe> bodyCache;
+    mutable mutex bodyLock;
+
+    // Full-text index over names and steps, built by the first search_text
+    // and kept up to date from then on
+    mutable unique_ptr<TextIndex> textIndex;
+    mutable mutex textLock;
+
+    // Trigram index over the ingredient table, brought up to date by each
+    // suggest_ingredients
+    mutable FuzzyMatcher ingredientMatcher;
+    mutable mutex matcherLock;
+
+    // Log that additions and deletions are recorded in, if one is attached
+    OperationLog* log;
+    // Sequence number of the last logged operation the book reflects
+    uint64_t logSequence;
+
+    // Changes since the last checkpoint: the slots whose contents changed,
+    // and how many categories there were then. After clear() only a full
+    // image can describe the book.
+    vector<uint32_t> dirtySlots;
+    vector<char> slotDirty;
+    size_t checkpointCategories;
+    bool needsFullCheckpoint;
+    uint64_t checkpointNumber;
+
+    void mark_slot_dirty(uint32_t slot) {
+        if (slot >= slotDirty.size()) {
+            slotDirty.resize(slots.size(), 0);
+        }
+        if (!slotDirty[slot]) {
+            slotDirty[slot] = 1;
+            dirtySlots.push_back(slot);
+        }
+    }
+
+    enum class LogOperation : uint8_t {
+        Add = 1,
+        Delete,
+        DeleteBatch,
+        Clear,
+        SetCookingTime
+    };
+
+    static void put_u32(string& record, uint32_t value) {
+        record.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void put_text(string& record, string_view text) {
+        put_u32(record, static_cast<uint32_t>(text.size()));
+        record.append(text.data(), text.size());
+    }
+
+    // Reads a log record's fields in order; ok turns false, and stays false,
+    // once a read runs past the end
+    struct LogReader {
+        string_view rest;
+        bool ok;
+
+        explicit LogReader(string_view record) : rest(record), ok(true) {}
+
+        uint8_t get_u8() {
+            if (rest.empty()) {
+                ok = false;
+                return 0;
+            }
+            uint8_t value = static_cast<uint8_t>(rest[0]);
+            rest.remove_prefix(1);
+            return value;
+        }
+
+        uint32_t get_u32() {
+            uint32_t value = 0;
+            if (rest.size() < sizeof(value)) {
+                ok = false;
+                return 0;
+            }
+            copy(rest.data(), rest.data() + sizeof(value), reinterpret_cast<char*>(&value));
+            rest.remove_prefix(sizeof(value));
+            return value;
+        }
+
+        string_view get_text() {
+            uint32_t size = get_u32();
+            if (!ok || rest.size() < size) {
+                ok = false;
+                return string_view();
+            }
+            string_view text = rest.substr(0, size);
+            rest.remove_prefix(size);
+            return text;
+        }
+    };
+
+    // Ingredients are logged by name, as IDs only mean something within one process
+    void log_add(const Recipe& recipe) {
+        if (log == nullptr) {
+            return;
+        }
+
+        const IngredientTable& table = IngredientTable::instance();
+        string record;
+        record.push_back(static_cast<char>(LogOperation::Add));
+        record.push_back(static_cast<char>(recipe.get_kind()));
+        put_u32(record, static_cast<uint32_t>(recipe.cookingTime));
+        put_text(record, recipe.name_view());
+        put_text(record, recipe_category(recipe));
+        put_u32(record, static_cast<uint32_t>(recipe.ingredient_ids_view().size()));
+        for (IngredientId id : recipe.ingredient_ids_view()) {
+            put_text(record, table.name_view(id));
+        }
+        put_u32(record, static_cast<uint32_t>(recipe.steps_view().size()));
+        for (const auto& step : recipe.steps_view()) {
+            put_text(record, step);
+        }
+        logSequence = log->append(record);
+    }
+
+    // Deletions are logged by handle. Replaying the log over the image it
+    // started from hands out slots in the same order, so the handles match.
+    void log_delete(LogOperation operation, const RecipeHandle* handles, size_t count) {
+        if (log == nullptr) {
+            return;
+        }
+
+        string record;
+        record.push_back(static_cast<char>(operation));
+        put_u32(record, static_cast<uint32_t>(count));
+        for (size_t i = 0; i < count; ++i) {
+            put_u32(record, handles[i].index);
+            put_u32(record, handles[i].generation);
+        }
+        logSequence = log->append(record);
+    }
+
+    // Redo one logged operation. Returns false for a record it cannot decode.
+    bool apply_log_record(string_view record) {
+        LogReader reader(record);
+        LogOperation operation = static_cast<LogOperation>(reader.get_u8());
+        switch (operation) {
+        case LogOperation::Add: {
+            RecipeKind kind = static_cast<RecipeKind>(reader.get_u8());
+            int time = static_cast<int>(reader.get_u32());
+            string_view name = reader.get_text();
+            string category(reader.get_text());
+            if (!reader.ok) {
+                return false;
+            }
+
+            IngredientTable& table = IngredientTable::instance();
+            Recipe* recipe = construct_empty_recipe(kind, category);
+            recipe->name.assign(name.data(), name.size());
+            recipe->cookingTime = time;
+            uint32_t ingredientCount = reader.get_u32();
+            for (uint32_t i = 0; i < ingredientCount && reader.ok; ++i) {
+                string_view ingredient = reader.get_text();
+                if (reader.ok) {
+                    recipe->ingredientIds.push_back(table.intern(string(ingredient)));
+                }
+            }
+            uint32_t stepCount = reader.get_u32();
+            for (uint32_t i = 0; i < stepCount && reader.ok; ++i) {
+                string_view step = reader.get_text();
+                if (reader.ok) {
+                    recipe->steps.emplace_back(step.data(), step.size());
+                }
+            }
+            if (!reader.ok) {
+                release_recipe(recipe);
+                return false;
+            }
+
+            add_recipe(recipe);
+            return true;
+        }
+        case LogOperation::Delete:
+        case LogOperation::DeleteBatch: {
+            uint32_t count = reader.get_u32();
+            vector<RecipeHandle> handles;
+            for (uint32_t i = 0; i < count && reader.ok; ++i) {
+                uint32_t index = reader.get_u32();
+                uint32_t generation = reader.get_u32();
+                handles.push_back(RecipeHandle(index, generation));
+            }
+            if (!reader.ok) {
+                return false;
+            }
+
+            // Each kind of deletion leaves the slots in its own order
+            if (operation == LogOperation::Delete) {
+                for (RecipeHandle handle : handles) {
+                    delete_recipe(handle);
+                }
+            }
+            else {
+                delete_recipes(handles);
+            }
+            return true;
+        }
+        case LogOperation::Clear:
+            clear();
+            return true;
+        case LogOperation::SetCookingTime: {
+            uint32_t index = reader.get_u32();
+            uint32_t generation = reader.get_u32();
+            int minutes = static_cast<int>(reader.get_u32());
+            if (!reader.ok) {
+                return false;
+            }
+            set_cooking_time(RecipeHandle(index, generation), minutes);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    // Add the recipe in store row `row` to the secondary indexes
+    void index_recipe(RecipeHandle handle, size_t row) {
+        for (IngredientId id : store.ingredients(row)) {
+            if (id >= ingredientIndex.size()) {
+                ingredientIndex.resize(IngredientTable::instance().size());
+            }
+            ingredientIndex[id].add(handle.index);
+        }
+        liveRecipes.add(handle.index);
+        cookingTimeIndex.emplace(store.cooking_time(row), handle.index);
+    }
+
+    void unindex_recipe(RecipeHandle handle, size_t row) {
+        for (IngredientId id : store.ingredients(row)) {
+            ingredientIndex[id].remove(handle.index);
+        }
+        liveRecipes.remove(handle.index);
+        cookingTimeIndex.erase(make_pair(store.cooking_time(row), handle.index));
+    }
+
+    // Walk cookingTimeIndex from the first entry at or above minMinutes, in
+    // ascending time, until fn returns false or maxMinutes is passed
+    template <typename Function>
+    void scan_cooking_times(int minMinutes, int maxMinutes, Function fn) const {
+        for (auto it = cookingTimeIndex.lower_bound(make_pair(minMinutes, uint32_t(0))); it != cookingTimeIndex.end() && it->first <= maxMinutes; ++it) {
+            if (!fn(it->second)) {
+                return;
+            }
+        }
+    }
+
+    // Bitmap for an ingredient name, or nullptr if no recipe has ever used it
+    const RecipeBitmap* find_ingredient_bitmap(const string& ingredient) const {
+        IngredientId id = IngredientTable::instance().find(ingredient);
+        if (id == IngredientTable::npos || id >= ingredientIndex.size()) {
+            return nullptr;
+        }
+        return &ingredientIndex[id];
+    }
+
+    // How run_query finds its first candidates
+    enum class AccessPath : uint8_t {
+        // Some condition can match nothing, so there are none
+        Empty,
+        Ingredient,
+        Category,
+        CookingTime,
+        FullScan
+    };
+
+    // A condition checked against the candidates' store rows
+    struct QueryFilter {
+        enum class Field : uint8_t {
+            Ingredient,
+            Category,
+            CookingTime
+        };
+
+        Field field;
+        bool negated;
+        uint32_t id;
+        // Estimated share of candidates that pass
+        double selectivity;
+    };
+
+    struct QueryPlan {
+        AccessPath path;
+        // Recipes the access path yields
+        size_t estimate;
+        // The ingredient or category the access path reads
+        uint32_t id;
+        int minMinutes;
+        int maxMinutes;
+        // Most selective first
+        vector<QueryFilter> filters;
+    };
+
+    // Candidates are filtered in batches of this many rows, each filter
+    // running over the whole batch before the next
+    static constexpr size_t query_batch = 1024;
+
+    // Share of recipes taking between minMinutes and maxMinutes, estimated
+    // from evenly spaced rows of the store's cooking time column
+    double sample_time_share(int minMinutes, int maxMinutes) const {
+        ArrayView<int> times = store.cooking_times();
+        if (times.empty()) {
+            return 0;
+        }
+        const size_t samples = min<size_t>(times.size(), 256);
+        const size_t stride = times.size() / samples;
+        size_t inRange = 0;
+        for (size_t i = 0; i < samples; ++i) {
+            int minutes = times[i * stride];
+            inRange += minutes >= minMinutes && minutes <= maxMinutes;
+        }
+        return static_cast<double>(inRange) / static_cast<double>(samples);
+    }
+
+    // Resolve a query's names and choose the access path that yields the
+    // fewest candidates. Ingredient and category sizes are exact; entries
+    // in the cooking time range are counted only up to the best size found
+    // so far, as beyond that the range cannot win; a range that loses is
+    // ordered among the filters by a sampled estimate.
+    QueryPlan plan_query(const RecipeQuery& query) const {
+        QueryPlan plan = { AccessPath::FullScan, recipes.size(), 0, query.minMinutes, query.maxMinutes, {} };
+        const double total = max<double>(1, static_cast<double>(recipes.size()));
+        auto empty_plan = [&]() {
+            plan.path = AccessPath::Empty;
+            plan.estimate = 0;
+            plan.filters.clear();
+            return plan;
+        };
+        if (query.minMinutes > query.maxMinutes) {
+            return empty_plan();
+        }
+
+        for (const RecipeQuery::NameCondition& condition : query.ingredients) {
+            IngredientId id = IngredientTable::instance().find(condition.name);
+            size_t matches = id < ingredientIndex.size() ? ingredientIndex[id].cardinality() : 0;
+            if (matches == 0) {
+                if (condition.negated) {
+                    continue;
+                }
+                return empty_plan();
+            }
+            double share = static_cast<double>(matches) / total;
+            plan.filters.push_back(QueryFilter{ QueryFilter::Field::Ingredient, condition.negated, id, condition.negated ? 1 - share : share });
+        }
+        for (const RecipeQuery::NameCondition& condition : query.categories) {
+            CategoryId id = categories.find(condition.name);
+            size_t matches = id != CategoryIndex::no_category ? category_size(id) : 0;
+            if (matches == 0) {
+                if (condition.negated) {
+                    continue;
+                }
+                return empty_plan();
+            }
+            double share = static_cast<double>(matches) / total;
+            plan.filters.push_back(QueryFilter{ QueryFilter::Field::Category, condition.negated, id, condition.negated ? 1 - share : share });
+        }
+
+        // The best indexed condition; negated ones cannot drive a lookup
+        size_t chosen = plan.filters.size();
+        for (size_t i = 0; i < plan.filters.size(); ++i) {
+            const QueryFilter& filter = plan.filters[i];
+            size_t matches = static_cast<size_t>(filter.selectivity * total + 0.5);
+            if (!filter.negated && matches < plan.estimate) {
+                plan.estimate = matches;
+                chosen = i;
+            }
+        }
+
+        size_t inRange = 0;
+        if (query.restricts_time()) {
+            scan_cooking_times(query.minMinutes, query.maxMinutes, [&](uint32_t) {
+                return ++inRange < plan.estimate;
+            });
+        }
+
+        if (query.restricts_time() && inRange < plan.estimate) {
+            plan.path = AccessPath::CookingTime;
+            plan.estimate = inRange;
+        }
+        else {
+            if (chosen < plan.filters.size()) {
+                plan.path = plan.filters[chosen].field == QueryFilter::Field::Ingredient ? AccessPath::Ingredient : AccessPath::Category;
+                plan.id = plan.filters[chosen].id;
+                plan.filters.erase(plan.filters.begin() + chosen);
+            }
+            if (query.restricts_time()) {
+                // Counting stopped early, so estimate the share from a sample
+                plan.filters.push_back(QueryFilter{ QueryFilter::Field::CookingTime, false, 0, sample_time_share(query.minMinutes, query.maxMinutes) });
+            }
+        }
+        if (plan.estimate == 0) {
+            return empty_plan();
+        }
+
+        stable_sort(plan.filters.begin(), plan.filters.end(), [](const QueryFilter& a, const QueryFilter& b) {
+            return a.selectivity < b.selectivity;
+        });
+        return plan;
+    }
+
+    // Keep the rows that pass filter, in order. Each field is read from its
+    // store column in one tight loop over the batch, writing every row and
+    // advancing only past those that pass, so the loop does not branch on
+    // the data.
+    void filter_rows(const QueryFilter& filter, const QueryPlan& plan, vector<uint32_t>& rows) const {
+        size_t kept = 0;
+        switch (filter.field) {
+        case QueryFilter::Field::CookingTime: {
+            const int* times = store.cooking_times().data();
+            for (uint32_t row : rows) {
+                rows[kept] = row;
+                kept += (times[row] >= plan.minMinutes) & (times[row] <= plan.maxMinutes);
+            }
+            break;
+        }
+        case QueryFilter::Field::Category: {
+            const CategoryId* ids = store.category_ids().data();
+            for (uint32_t row : rows) {
+                rows[kept] = row;
+                kept += (ids[row] == filter.id) != filter.negated;
+            }
+            break;
+        }
+        case QueryFilter::Field::Ingredient:
+            for (uint32_t row : rows) {
+                ArrayView<IngredientId> ingredients = store.ingredients(row);
+                bool present = find(ingredients.begin(), ingredients.end(), filter.id) != ingredients.end();
+                rows[kept] = row;
+                kept += present != filter.negated;
+            }
+            break;
+        }
+        rows.resize(kept);
+    }
+
+    // Construct a recipe in the arena, or on the heap if there is none,
+    // without adding it to the book
+    template <typename RecipeType, typename... Args>
+    RecipeType* construct_recipe(Args&&... args) {
+        if (pool) {
+            void* memory = pool->allocate(sizeof(RecipeType), alignof(RecipeType));
+            return new (memory) RecipeType(std::forward<Args>(args)..., pool.get());
+        }
+        return new RecipeType(std::forward<Args>(args)...);
+    }
+
+    // Presents the whole book, or only what changed since the last
+    // checkpoint, to RecipeImage::write
+    class ImageSource {
+    private:
+        const RecipeBook& book;
+        bool delta;
+        // Dense indexes of the recipes to write
+        vector<uint32_t> rows;
+
+    public:
+        ImageSource(const RecipeBook& source, bool deltaOnly) : book(source), delta(deltaOnly) {
+            if (delta) {
+                for (uint32_t slot : book.dirtySlots) {
+                    if (book.liveRecipes.contains(slot)) {
+                        rows.push_back(book.slots[slot].denseIndex);
+                    }
+                }
+            }
+            else {
+                rows.resize(book.recipes.size());
+                for (uint32_t row = 0; row < rows.size(); ++row) {
+                    rows[row] = row;
+                }
+            }
+        }
+
+        bool is_delta() const {
+            return delta;
+        }
+
+        uint64_t checkpoint() const {
+            return book.checkpointNumber + 1;
+        }
+
+        uint64_t log_sequence() const {
+            return book.logSequence;
+        }
+
+        size_t size() const {
+            return rows.size();
+        }
+
+        string_view name(size_t row) const {
+            return book.store.name(rows[row]);
+        }
+
+        int cooking_time(size_t row) const {
+            return book.store.cooking_time(rows[row]);
+        }
+
+        CategoryId category_id(size_t row) const {
+            return book.store.category_id(rows[row]);
+        }
+
+        RecipeKind kind(size_t row) const {
+            return book.recipes[rows[row]]->get_kind();
+        }
+
+        uint32_t slot(size_t row) const {
+            return book.recipes[rows[row]]->handle.index;
+        }
+
+        size_t ingredient_count(size_t row) const {
+            return book.store.ingredients(rows[row]).size();
+        }
+
+        template <typename Function>
+        void for_each_ingredient(size_t row, Function fn) const {
+            for (IngredientId id : book.store.ingredients(rows[row])) {
+                fn(id);
+            }
+        }
+
+        size_t step_count(size_t row) const {
+            return book.step_count(rows[row]);
+        }
+
+        string_view step(size_t row, size_t i) const {
+            return book.step(rows[row], i);
+        }
+
+        // Ingredient IDs passed to for_each_ingredient are below this
+        size_t ingredient_space() const {
+            return IngredientTable::instance().size();
+        }
+
+        string_view ingredient_name(IngredientId id) const {
+            return IngredientTable::instance().name_view(id);
+        }
+
+        CategoryId first_category() const {
+            return delta ? static_cast<CategoryId>(book.checkpointCategories) : 0;
+        }
+
+        size_t category_count() const {
+            return book.categories.size() - first_category();
+        }
+
+        string_view category_name(CategoryId id) const {
+            return book.categories.name(id);
+        }
+
+        size_t slot_count() const {
+            return book.slots.size();
+        }
+
+        size_t changed_slot_count() const {
+            return delta ? book.dirtySlots.size() : 0;
+        }
+
+        uint32_t changed_slot(size_t i) const {
+            return book.dirtySlots[i];
+        }
+
+        uint32_t slot_generation(size_t i) const {
+            return book.slots[delta ? book.dirtySlots[i] : i].generation;
+        }
+
+        ArrayView<uint32_t> free_slots() const {
+            return book.freeSlots;
+        }
+    };
+
+    // Write through a temporary file, synced and renamed over path once
+    // complete, so a true return means the image is on disk
+    static bool write_image(const string& path, const ImageSource& source) {
+        string temporaryPath = path + ".tmp";
+        if (!RecipeImage::write(temporaryPath, source) || !replace_file_durably(temporaryPath, path)) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // The process-wide ID of each of an image's ingredients
+    static vector<IngredientId> map_image_ingredients(const RecipeImage& image) {
+        IngredientTable& table = IngredientTable::instance();
+        vector<IngredientId> ingredientMap(image.ingredient_count());
+        for (IngredientId id = 0; id < ingredientMap.size(); ++id) {
+            ingredientMap[id] = table.intern(string(image.ingredient_name(id)));
+        }
+        return ingredientMap;
+    }
+
+    // Image row holding the body of the recipe at a dense index, or
+    // no_body_row if the recipe holds its own
+    uint32_t body_row(size_t index) const {
+        uint32_t slot = recipes[index]->handle.index;
+        return slot < bodyRows.size() ? bodyRows[slot] : no_body_row;
+    }
+
+    // Steps of the recipe at a dense index, wherever they are kept
+    size_t step_count(size_t index) const {
+        uint32_t row = body_row(index);
+        return row == no_body_row ? recipes[index]->steps_view().size() : bodyImage->step_count(row);
+    }
+
+    string_view step(size_t index, size_t i) const {
+        uint32_t row = body_row(index);
+        return row == no_body_row ? string_view(recipes[index]->steps_view()[i]) : bodyImage->step(row, i);
+    }
+
+    // Add the recipe at a dense index to the full-text index, which must exist
+    void index_text(size_t index) const {
+        textIndex->add(recipes[index]->handle.index, [&](auto add) {
+            add(recipes[index]->name_view());
+            for (size_t i = 0; i < step_count(index); ++i) {
+                add(step(index, i));
+            }
+        });
+    }
+
+    // Build the recipe in an image row. It is constructed empty and filled in
+    // from the image's views, so the strings are copied once, straight into
+    // the recipe's allocator.
+    Recipe* recipe_from_image(const RecipeImage& image, size_t row, const vector<IngredientId>& ingredientMap, const string& category) {
+        Recipe* recipe = construct_empty_recipe(image.kind(row), category);
+
+        string_view name = image.name(row);
+        recipe->name.assign(name.data(), name.size());
+        recipe->cookingTime = image.cooking_time(row);
+
+        ArrayView<IngredientId> ingredients = image.ingredients(row);
+        recipe->ingredientIds.reserve(ingredients.size());
+        for (IngredientId id : ingredients) {
+            if (id < ingredientMap.size()) {
+                recipe->ingredientIds.push_back(ingredientMap[id]);
+            }
+        }
+
+        size_t stepCount = image.step_count(row);
+        recipe->steps.reserve(stepCount);
+        for (size_t i = 0; i < stepCount; ++i) {
+            string_view step = image.step(row, i);
+            recipe->steps.emplace_back(step.data(), step.size());
+        }
+        return recipe;
+    }
+
+    // allocate_slot takes free slots from the back, so queue each image
+    // row's saved slot in reverse for add_recipes to pick up in order
+    void queue_image_slots(const RecipeImage& image) {
+        for (size_t row = image.size(); row-- > 0;) {
+            freeSlots.push_back(image.slot(row));
+        }
+    }
+
+    // Whether an image's slot layout is consistent: every slot index in range
+    // and used by at most one recipe or free list entry
+    static bool image_slots_valid(const RecipeImage& image) {
+        vector<char> used(image.slot_count(), 0);
+        auto claim = [&used](uint32_t slot) {
+            if (slot >= used.size() || used[slot]) {
+                return false;
+            }
+            used[slot] = 1;
+            return true;
+        };
+        for (size_t row = 0; row < image.size(); ++row) {
+            if (!claim(image.slot(row))) {
+                return false;
+            }
+        }
+        for (uint32_t slot : image.free_slots()) {
+            if (!claim(slot)) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < image.changed_slot_count(); ++i) {
+            if (image.changed_slot(i) >= used.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A recipe of the given kind with no name, ingredients or steps yet, for
+    // filling in from stored data
+    Recipe* construct_empty_recipe(RecipeKind kind, const string& category) {
+        const string noName;
+        const vector<string> noItems;
+        switch (kind) {
+        case RecipeKind::MainCourse:
+            return construct_recipe<MainCourseRecipe>(noName, noItems, noItems, 0, category);
+        case RecipeKind::Dessert:
+            return construct_recipe<DessertRecipe>(noName, noItems, noItems, 0, category);
+        default:
+            return construct_recipe<Recipe>(noName, noItems, noItems, 0);
+        }
+    }
+
+    // Same as construct_empty_recipe, always on the heap, for copies that
+    // outlive the arena's lifetime rules
+    static unique_ptr<Recipe> make_empty_recipe(RecipeKind kind, const string& category) {
+        const string noName;
+        const vector<string> noItems;
+        switch (kind) {
+        case RecipeKind::MainCourse:
+            return unique_ptr<Recipe>(new MainCourseRecipe(noName, noItems, noItems, 0, category));
+        case RecipeKind::Dessert:
+            return unique_ptr<Recipe>(new DessertRecipe(noName, noItems, noItems, 0, category));
+        default:
+            return unique_ptr<Recipe>(new Recipe(noName, noItems, noItems, 0));
+        }
+    }
+
+    bool owned_by_arena(const Recipe* recipe) const {
+        return pool && recipe->get_memory_resource() == pool.get();
+    }
+
+    // Destroy a recipe, returning its memory to wherever it came from
+    void release_recipe(Recipe* recipe) {
+        if (owned_by_arena(recipe)) {
+            // Back to the pool, sized as construct_recipe allocated it
+            RecipeKind kind = recipe->get_kind();
+            void* memory = dynamic_cast<void*>(recipe);
+            recipe->~Recipe();
+            switch (kind) {
+            case RecipeKind::MainCourse:
+                pool->deallocate(memory, sizeof(MainCourseRecipe), alignof(MainCourseRecipe));
+                break;
+            case RecipeKind::Dessert:
+                pool->deallocate(memory, sizeof(DessertRecipe), alignof(DessertRecipe));
+                break;
+            default:
+                pool->deallocate(memory, sizeof(Recipe), alignof(Recipe));
+                break;
+            }
+        }
+        else {
+            delete recipe;
+        }
+    }
+
+    RecipeHandle allocate_slot(uint32_t denseIndex) {
+        uint32_t slotIndex;
+        if (!freeSlots.empty()) {
+            slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else {
+            slotIndex = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot{ 0, 0, 0 });
+        }
+
+        slots[slotIndex].denseIndex = denseIndex;
+        mark_slot_dirty(slotIndex);
+        return RecipeHandle(slotIndex, slots[slotIndex].generation);
+    }
+
+    // Bumping the generation invalidates every outstanding handle to the slot
+    void free_slot(RecipeHandle handle) {
+        if (handle.index < bodyRows.size() && bodyRows[handle.index] != no_body_row) {
+            bodyRows[handle.index] = no_body_row;
+            lock_guard<mutex> guard(bodyLock);
+            bodyCache.erase(handle.index);
+        }
+        if (textIndex) {
+            lock_guard<mutex> guard(textLock);
+            textIndex->remove(handle.index);
+        }
+        ++slots[handle.index].generation;
+        freeSlots.push_back(handle.index);
+        mark_slot_dirty(handle.index);
+    }
+
+    // An image whose prebuilt indexes describe a batch being loaded from it
+    struct PrebuiltIndexes {
+        const RecipeImage& image;
+        // Process-wide ID of each of the image's ingredients
+        const vector<IngredientId>& ingredientMap;
+    };
+
+    // Fill the indexes of a book that was empty before the batch from an
+    // image's prebuilt ones. Everything is already grouped and sorted, so
+    // this only copies.
+    void adopt_indexes(const PrebuiltIndexes& prebuilt) {
+        const RecipeImage& image = prebuilt.image;
+        for (CategoryId id = 0; id < image.category_count(); ++id) {
+            ArrayView<uint32_t> members = image.category_members(id);
+            categories.reserve_additional(id, members.size());
+            for (uint32_t slot : members) {
+                slots[slot].categoryPosition = categories.add(id, RecipeHandle(slot, slots[slot].generation));
+            }
+        }
+
+        ingredientIndex.resize(max(ingredientIndex.size(), IngredientTable::instance().size()));
+        for (IngredientId id = 0; id < image.ingredient_count(); ++id) {
+            ArrayView<uint32_t> postings = image.ingredient_postings(id);
+            if (!postings.empty()) {
+                ingredientIndex[prebuilt.ingredientMap[id]].add_sorted(postings.data(), postings.size());
+            }
+        }
+
+        ArrayView<uint32_t> live = image.live_slots();
+        liveRecipes.add_sorted(live.data(), live.size());
+        for (const RecipeImage::TimeEntry& entry : image.cooking_time_index()) {
+            cookingTimeIndex.emplace_hint(cookingTimeIndex.end(), entry.time, entry.slot);
+        }
+    }
+
+    // add_recipes, with each recipe's ingredients passed separately so that
+    // lazily loaded recipes can be indexed without holding them. With
+    // prebuilt indexes, those are adopted instead of building new ones.
+    vector<RecipeHandle> add_batch(const vector<Recipe*>& batch, const vector<ArrayView<IngredientId>>& ingredientLists, const PrebuiltIndexes* prebuilt = nullptr) {
+        vector<RecipeHandle> handles;
+        handles.reserve(batch.size());
+        size_t firstRow = recipes.size();
+
+        size_t ingredientCount = 0;
+        size_t nameBytes = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            ingredientCount += ingredientLists[i].size();
+            nameBytes += batch[i]->name.size();
+        }
+        recipes.reserve(firstRow + batch.size());
+        slots.reserve(slots.size() + batch.size());
+        store.reserve_additional(batch.size(), ingredientCount, nameBytes);
+
+        // Slots, dense array and store rows, counting recipes per category
+        vector<size_t> categoryCounts(categories.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Recipe* recipe = batch[i];
+            RecipeHandle handle = allocate_slot(static_cast<uint32_t>(recipes.size()));
+            recipe->handle = handle;
+            recipes.push_back(recipe);
+            handles.push_back(handle);
+
+            CategoryId categoryId = CategoryIndex::no_category;
+            if (recipe->get_kind() != RecipeKind::Plain) {
+                categoryId = categories.intern(recipe_category(*recipe));
+                if (categoryId >= categoryCounts.size()) {
+                    categoryCounts.resize(categoryId + 1);
+                }
+                ++categoryCounts[categoryId];
+            }
+            store.append(*recipe, categoryId, ingredientLists[i]);
+            log_add(*recipe);
+        }
+        if (textIndex) {
+            lock_guard<mutex> guard(textLock);
+            for (size_t row = firstRow; row < recipes.size(); ++row) {
+                index_text(row);
+            }
+        }
+
+        if (prebuilt != nullptr) {
+            adopt_indexes(*prebuilt);
+            return handles;
+        }
+
+        // Category member lists, each grown once
+        for (CategoryId id = 0; id < categoryCounts.size(); ++id) {
+            if (categoryCounts[id] != 0) {
+                categories.reserve_additional(id, categoryCounts[id]);
+            }
+        }
+        for (size_t row = firstRow; row < recipes.size(); ++row) {
+            CategoryId categoryId = store.category_id(row);
+            if (categoryId != CategoryIndex::no_category) {
+                slots[recipes[row]->handle.index].categoryPosition = categories.add(categoryId, recipes[row]->handle);
+            }
+        }
+
+        // Group the new slots by ingredient with a counting sort
+        size_t vocabulary = IngredientTable::instance().size();
+        if (ingredientIndex.size() < vocabulary) {
+            ingredientIndex.resize(vocabulary);
+        }
+        vector<uint32_t> groupOffsets(vocabulary + 1, 0);
+        for (size_t row = firstRow; row < recipes.size(); ++row) {
+            for (IngredientId id : store.ingredients(row)) {
+                ++groupOffsets[id + 1];
+            }
+        }
+        for (size_t id = 0; id < vocabulary; ++id) {
+            groupOffsets[id + 1] += groupOffsets[id];
+        }
+        vector<uint32_t> groupedSlots(groupOffsets[vocabulary]);
+        vector<uint32_t> cursor(groupOffsets.begin(), groupOffsets.end() - 1);
+        for (size_t row = firstRow; row < recipes.size(); ++row) {
+            for (IngredientId id : store.ingredients(row)) {
+                groupedSlots[cursor[id]++] = recipes[row]->handle.index;
+            }
+        }
+
+        // Each ingredient's bitmap is independent, so they can be built concurrently
+        parallel_for(vocabulary, [&](size_t id) {
+            uint32_t* first = groupedSlots.data() + groupOffsets[id];
+            uint32_t* last = groupedSlots.data() + groupOffsets[id + 1];
+            if (first != last) {
+                sort(first, last);
+                ingredientIndex[id].add_sorted(first, last - first);
+            }
+        });
+
+        vector<uint32_t> newSlots;
+        newSlots.reserve(batch.size());
+        vector<pair<int, uint32_t>> timeEntries;
+        timeEntries.reserve(batch.size());
+        for (size_t row = firstRow; row < recipes.size(); ++row) {
+            newSlots.push_back(recipes[row]->handle.index);
+            timeEntries.emplace_back(store.cooking_time(row), recipes[row]->handle.index);
+        }
+        sort(newSlots.begin(), newSlots.end());
+        liveRecipes.add_sorted(newSlots.data(), newSlots.size());
+
+        // A set builds from sorted input in linear time, so merge and rebuild
+        // when the batch is large; otherwise insert in order with hints
+        sort(timeEntries.begin(), timeEntries.end());
+        if (timeEntries.size() >= cookingTimeIndex.size()) {
+            vector<pair<int, uint32_t>> merged;
+            merged.reserve(cookingTimeIndex.size() + timeEntries.size());
+            merge(cookingTimeIndex.begin(), cookingTimeIndex.end(), timeEntries.begin(), timeEntries.end(), back_inserter(merged));
+            cookingTimeIndex = set<pair<int, uint32_t>>(merged.begin(), merged.end());
+        }
+        else {
+            auto hint = cookingTimeIndex.begin();
+            for (const auto& entry : timeEntries) {
+                hint = next(cookingTimeIndex.insert(hint, entry));
+            }
+        }
+
+        return handles;
+    }
+
+
+    // Add every recipe in a full image in one batch, keeping the handles
+    // they were saved with when the book is empty; the image's prebuilt
+    // indexes are then used if they check out. Without bodies, recipes get
+    // only their name, cooking time and category, and their ingredients go
+    // straight to the indexes.
+    vector<RecipeHandle> add_image_recipes(const RecipeImage& image, bool withBodies) {
+        bool restoreSlots = recipes.empty() && slots.empty() && image_slots_valid(image);
+
+        // Register the categories in the image's order so the book numbers
+        // them the same way, including any that no recipe uses any more
+        for (CategoryId id = 0; id < image.category_count(); ++id) {
+            categories.intern(image.category_name(id));
+        }
+
+        vector<IngredientId> ingredientMap = map_image_ingredients(image);
+        vector<Recipe*> batch;
+        batch.reserve(image.size());
+        // Ingredients of recipes loaded without bodies, mapped to process IDs
+        vector<IngredientId> ingredients;
+        vector<size_t> ingredientOffsets;
+        for (size_t row = 0; row < image.size(); ++row) {
+            string category(image.category_name(image.category_id(row)));
+            if (withBodies) {
+                batch.push_back(recipe_from_image(image, row, ingredientMap, category));
+                continue;
+            }
+
+            Recipe* recipe = construct_empty_recipe(image.kind(row), category);
+            string_view name = image.name(row);
+            recipe->name.assign(name.data(), name.size());
+            recipe->cookingTime = image.cooking_time(row);
+            batch.push_back(recipe);
+
+            ingredientOffsets.push_back(ingredients.size());
+            for (IngredientId id : image.ingredients(row)) {
+                if (id < ingredientMap.size()) {
+                    ingredients.push_back(ingredientMap[id]);
+                }
+            }
+        }
+
+        if (restoreSlots) {
+            slots.resize(image.slot_count(), Slot{ 0, 0, 0 });
+            for (size_t slot = 0; slot < slots.size(); ++slot) {
+                slots[slot].generation = image.slot_generation(slot);
+            }
+            queue_image_slots(image);
+        }
+
+        vector<ArrayView<IngredientId>> ingredientLists;
+        ingredientLists.reserve(batch.size());
+        ingredientOffsets.push_back(ingredients.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (withBodies) {
+                ingredientLists.push_back(batch[i]->ingredient_ids_view());
+            }
+            else {
+                ingredientLists.emplace_back(ingredients.data() + ingredientOffsets[i], ingredientOffsets[i + 1] - ingredientOffsets[i]);
+            }
+        }
+
+        // Prebuilt indexes number categories and slots as the image does,
+        // so they only fit a book that was empty
+        PrebuiltIndexes prebuilt = { image, ingredientMap };
+        bool usePrebuilt = restoreSlots && categories.size() == image.category_count() && image.indexes_intact();
+        vector<RecipeHandle> handles = add_batch(batch, ingredientLists, usePrebuilt ? &prebuilt : nullptr);
+
+        if (restoreSlots) {
+            ArrayView<uint32_t> savedFreeSlots = image.free_slots();
+            freeSlots.assign(savedFreeSlots.begin(), savedFreeSlots.end());
+            checkpointNumber = image.checkpoint();
+        }
+        logSequence = max(logSequence, image.log_sequence());
+        return handles;
+    }
+
+    void remove_at(size_t index) {
+        Recipe* recipeToDelete = recipes[index];
+        RecipeHandle handle = recipeToDelete->handle;
+        log_delete(LogOperation::Delete, &handle, 1);
+        unindex_recipe(handle, index);
+
+        CategoryId categoryId = store.category_id(index);
+        if (categoryId != CategoryIndex::no_category) {
+            RecipeHandle moved = categories.remove(categoryId, slots[handle.index].categoryPosition);
+            if (moved != RecipeHandle()) {
+                slots[moved.index].categoryPosition = slots[handle.index].categoryPosition;
+            }
+        }
+
+        // Move the last recipe into the gap so removal does not shift the array
+        store.swap_remove(index);
+        recipes[index] = recipes.back();
+        slots[recipes[index]->handle.index].denseIndex = static_cast<uint32_t>(index);
+        recipes.pop_back();
+
+        // Delete the recipe
+        free_slot(handle);
+        release_recipe(recipeToDelete);
+    }
+
+public:
+
+    // Recipes are allocated individually on the heap
+    RecipeBook() : bodyCache(default_body_cache), log(nullptr), logSequence(0), checkpointCategories(0), needsFullCheckpoint(true), checkpointNumber(0) {}
+
+    // Recipes created through emplace_recipe come from an arena that grows in
+    // blocks starting at arenaBlockSize bytes and is freed in one go by clear().
+    // A pool over the arena reuses what deleted or rewritten recipes free;
+    // the arena itself only shrinks when the book is cleared.
+    explicit RecipeBook(size_t arenaBlockSize) : arena(new pmr::monotonic_buffer_resource(arenaBlockSize)),
+        pool(new pmr::unsynchronized_pool_resource(arena.get())), bodyCache(default_body_cache), log(nullptr), logSequence(0), checkpointCategories(0), needsFullCheckpoint(true), checkpointNumber(0) {}
+
+    // The book owns its recipes, so it cannot be copied
+    RecipeBook(const RecipeBook&) = delete;
+    RecipeBook& operator=(const RecipeBook&) = delete;
+
+    ~RecipeBook() {
+        release_all();
+    }
+
+    const vector<Recipe*>& getRecipes() const {
+        return recipes;
+    }
+
+    const CategoryIndex& getCategories() const {
+        return categories;
+    }
+
+    // Number of recipes in a category, where CategoryIndex::all is the whole book
+    size_t category_size(CategoryId id) const {
+        if (id == CategoryIndex::all) {
+            return recipes.size();
+        }
+        return categories.recipes(id).size();
+    }
+
+    // The recipe at position i of a category, numbered as for category_size
+    Recipe* category_recipe(CategoryId id, size_t i) const {
+        if (id == CategoryIndex::all) {
+            return recipes[i];
+        }
+        return get(categories.recipes(id)[i]);
+    }
+
+    const RecipeStore& getStore() const {
+        return store;
+    }
+
+    // Resolve a handle, or nullptr if the recipe has since been deleted
+    Recipe* get(RecipeHandle handle) const {
+        if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation) {
+            return nullptr;
+        }
+        return recipes[slots[handle.index].denseIndex];
+    }
+
+    bool contains(RecipeHandle handle) const {
+        return get(handle) != nullptr;
+    }
+
+    // Construct a recipe in the book's arena, or on the heap if there is none, and add it
+    template <typename RecipeType>
+    RecipeType* emplace_recipe(const string& n, const vector<string>& ing, const vector<string>& st, int time) {
+        RecipeType* newRecipe = construct_recipe<RecipeType>(n, ing, st, time);
+        add_recipe(newRecipe);
+        return newRecipe;
+    }
+
+    // Same as above for recipe types with a cuisine or dessert type
+    template <typename RecipeType>
+    RecipeType* emplace_recipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, const string& category) {
+        RecipeType* newRecipe = construct_recipe<RecipeType>(n, ing, st, time, category);
+        add_recipe(newRecipe);
+        return newRecipe;
+    }
+
+    // Change a recipe in the book: the recipe at handle is replaced by one
+    // built from args as emplace_recipe would, which the store and every
+    // index then describe. The replacement's handle is returned and the old
+    // one goes stale, as on deletion. A stale handle changes nothing and
+    // returns RecipeHandle().
+    template <typename RecipeType, typename... Args>
+    RecipeHandle update_recipe(RecipeHandle handle, Args&&... args) {
+        if (get(handle) == nullptr) {
+            return RecipeHandle();
+        }
+        remove_at(slots[handle.index].denseIndex);
+        return emplace_recipe<RecipeType>(std::forward<Args>(args)...)->get_handle();
+    }
+
+    // A recipe of the given kind with no name, ingredients or steps yet, in
+    // the book's arena when it has one. Fill it in and pass it to add_recipe
+    // or add_recipes, which take ownership of it.
+    Recipe* create_recipe(RecipeKind kind, const string& category) {
+        return construct_empty_recipe(kind, category);
+    }
+
+    // Add many recipes at once; the book takes ownership of them. Every
+    // container is sized up front, and the secondary indexes are built from
+    // sorted runs instead of one insertion per recipe. The per-ingredient
+    // bitmaps are built in parallel.
+    vector<RecipeHandle> add_recipes(const vector<Recipe*>& batch) {
+        vector<ArrayView<IngredientId>> ingredientLists;
+        ingredientLists.reserve(batch.size());
+        for (const Recipe* recipe : batch) {
+            ingredientLists.push_back(recipe->ingredient_ids_view());
+        }
+        return add_batch(batch, ingredientLists);
+    }
+
+    // Add a new recipe; the book takes ownership of it
+    RecipeHandle add_recipe(Recipe* newRecipe) {
+        RecipeHandle handle = allocate_slot(static_cast<uint32_t>(recipes.size()));
+        newRecipe->handle = handle;
+        recipes.push_back(newRecipe);
+
+        // Categorize by the recipe's kind tag
+        CategoryId categoryId = CategoryIndex::no_category;
+        if (newRecipe->get_kind() != RecipeKind::Plain) {
+            categoryId = categories.intern(recipe_category(*newRecipe));
+            slots[handle.index].categoryPosition = categories.add(categoryId, handle);
+        }
+        store.append(*newRecipe, categoryId, newRecipe->ingredient_ids_view());
+
+        index_recipe(handle, recipes.size() - 1);
+        if (textIndex) {
+            lock_guard<mutex> guard(textLock);
+            index_text(recipes.size() - 1);
+        }
+        log_add(*newRecipe);
+        return handle;
+    }
+
+    // Display all recipes
+    void display_all_recipes() const {
+        cout << "All Recipes:\n";
+        for (const auto& recipe : recipes) {
+            visit_recipe(*full_recipe(recipe), [](const auto& concrete) { concrete.display(); });
+            cout << "-----------------\n";
+        }
+    }
+
+    // Display recipes based on a specific category
+    void display_recipes_by_category(const string& category) const {
+        CategoryId id = category == "All" ? CategoryIndex::all : categories.find(category);
+        if (id != CategoryIndex::no_category) {
+            cout << "Recipes in Category '" << category << "':\n";
+            for (size_t i = 0; i < category_size(id); ++i) {
+                visit_recipe(*full_recipe(category_recipe(id, i)), [](const auto& concrete) { concrete.display(); });
+                cout << "-----------------\n";
+            }
+        }
+        else {
+            cout << "Category not found.\n";
+        }
+    }
+
+    // Search for recipes based on ingredients
+    vector<Recipe*> search_recipes_by_ingredient(const string& ingredient) const {
+        const RecipeBitmap* matches = find_ingredient_bitmap(ingredient);
+        if (matches == nullptr) {
+            return vector<Recipe*>();
+        }
+        return resolve(*matches);
+    }
+
+    // One page of up to pageSize recipes using ingredient, starting after
+    // the cursor a previous page returned. Results are produced lazily, so
+    // the cost follows the page rather than the whole result: in slot order
+    // the ingredient's bitmap is walked from the cursor. Fastest first, the
+    // cooking time index is walked from the cursor, keeping the recipes
+    // that use the ingredient. When the ingredient is too rare for that to
+    // find a page quickly, a bounded heap picks the next page from its
+    // recipes instead.
+    RecipePage search_recipes_by_ingredient_page(const string& ingredient, size_t pageSize, const PageCursor& after = PageCursor(), PageOrder order = PageOrder::Slot) const {
+        RecipePage page;
+        page.next = after;
+        page.more = false;
+        const RecipeBitmap* matches = find_ingredient_bitmap(ingredient);
+        if (matches == nullptr || pageSize == 0) {
+            return page;
+        }
+        // One more than the page, to tell whether another follows
+        const size_t wanted = pageSize + 1;
+        vector<uint32_t> found;
+        found.reserve(wanted);
+
+        if (order == PageOrder::Slot) {
+            if (after.started && after.slot == UINT32_MAX) {
+                return page;
+            }
+            matches->for_each_from(after.started ? after.slot + 1 : 0, [&](uint32_t slot) {
+                found.push_back(slot);
+                return found.size() < wanted;
+            });
+        }
+        else {
+            auto key = [&](uint32_t slot) {
+                return make_pair(store.cooking_time(slots[slot].denseIndex), slot);
+            };
+            const pair<int, uint32_t> last(after.minutes, after.slot);
+            auto is_new = [&](const pair<int, uint32_t>& entry) {
+                return !after.started || entry > last;
+            };
+
+            // A walk visits about wanted * size / matches entries of the
+            // time index to fill the page; the heap visits every match
+            const size_t matchCount = matches->cardinality();
+            if (static_cast<double>(matchCount) * static_cast<double>(matchCount) >= static_cast<double>(wanted) * static_cast<double>(recipes.size())) {
+                auto it = after.started ? cookingTimeIndex.upper_bound(last) : cookingTimeIndex.begin();
+                for (; it != cookingTimeIndex.end() && found.size() < wanted; ++it) {
+                    if (matches->contains(it->second)) {
+                        found.push_back(it->second);
+                    }
+                }
+            }
+            else {
+                // The smallest keys after the cursor, largest on top
+                vector<pair<int, uint32_t>> best;
+                best.reserve(wanted + 1);
+                matches->for_each([&](uint32_t slot) {
+                    pair<int, uint32_t> entry = key(slot);
+                    if (!is_new(entry) || (best.size() == wanted && entry > best.front())) {
+                        return;
+                    }
+                    best.push_back(entry);
+                    push_heap(best.begin(), best.end());
+                    if (best.size() > wanted) {
+                        pop_heap(best.begin(), best.end());
+                        best.pop_back();
+                    }
+                });
+                sort_heap(best.begin(), best.end());
+                for (const auto& entry : best) {
+                    found.push_back(entry.second);
+                }
+            }
+        }
+
+        page.more = found.size() > pageSize;
+        found.resize(min(found.size(), pageSize));
+        page.recipes.reserve(found.size());
+        for (uint32_t slot : found) {
+            page.recipes.push_back(recipes[slots[slot].denseIndex]);
+        }
+        if (!found.empty()) {
+            page.next.started = true;
+            page.next.slot = found.back();
+            page.next.minutes = store.cooking_time(slots[found.back()].denseIndex);
+        }
+        return page;
+    }
+
+    // Up to limit ingredients used in the book whose names are within
+    // maxDistance edits of typed, ignoring case, closest first. Cheap enough
+    // to run on every keystroke, to offer "Parmesan Cheese" for "parmesean
+    // cheese" before search_recipes_by_ingredient.
+    vector<string> suggest_ingredients(string_view typed, uint32_t maxDistance = 2, size_t limit = 10) const {
+        lock_guard<mutex> guard(matcherLock);
+        const IngredientTable& table = IngredientTable::instance();
+        ingredientMatcher.update(table);
+
+        vector<string> suggestions;
+        for (const FuzzyMatcher::Match& match : ingredientMatcher.find(typed, maxDistance)) {
+            if (suggestions.size() == limit) {
+                break;
+            }
+            if (match.id < ingredientIndex.size() && !ingredientIndex[match.id].empty()) {
+                suggestions.push_back(table.name(match.id));
+            }
+        }
+        return suggestions;
+    }
+
+    // Evaluate an AND/OR/NOT combination of ingredients as bitmap operations
+    RecipeBitmap match_ingredients(const IngredientQuery& query) const {
+        RecipeBitmap result;
+        bool restricted = false;
+
+        if (!query.allOf.empty()) {
+            vector<const RecipeBitmap*> required;
+            for (const auto& ingredient : query.allOf) {
+                const RecipeBitmap* bitmap = find_ingredient_bitmap(ingredient);
+                if (bitmap == nullptr) {
+                    return RecipeBitmap();
+                }
+                required.push_back(bitmap);
+            }
+
+            // Intersect starting from the rarest ingredient so the running result stays small
+            sort(required.begin(), required.end(), [](const RecipeBitmap* a, const RecipeBitmap* b) {
+                return a->cardinality() < b->cardinality();
+            });
+            result = *required[0];
+            for (size_t i = 1; i < required.size() && !result.empty(); ++i) {
+                result = RecipeBitmap::intersect(result, *required[i]);
+            }
+            restricted = true;
+        }
+
+        if (!query.anyOf.empty()) {
+            RecipeBitmap alternatives;
+            for (const auto& ingredient : query.anyOf) {
+                const RecipeBitmap* bitmap = find_ingredient_bitmap(ingredient);
+                if (bitmap != nullptr) {
+                    alternatives = RecipeBitmap::unite(alternatives, *bitmap);
+                }
+            }
+            result = restricted ? RecipeBitmap::intersect(result, alternatives) : alternatives;
+            restricted = true;
+        }
+
+        if (!restricted) {
+            result = liveRecipes;
+        }
+
+        for (const auto& ingredient : query.noneOf) {
+            const RecipeBitmap* bitmap = find_ingredient_bitmap(ingredient);
+            if (bitmap != nullptr && !result.empty()) {
+                result = RecipeBitmap::subtract(result, *bitmap);
+            }
+        }
+        return result;
+    }
+
+    vector<Recipe*> search_recipes(const IngredientQuery& query) const {
+        return resolve(match_ingredients(query));
+    }
+
+    // Up to k recipes whose name or steps contain words of text, such as
+    // "bake in the oven", best match first by BM25. The full-text index is
+    // built by the first call.
+    vector<Recipe*> search_text(string_view text, size_t k = 10) const {
+        lock_guard<mutex> guard(textLock);
+        if (!textIndex) {
+            textIndex.reset(new TextIndex());
+            for (size_t index = 0; index < recipes.size(); ++index) {
+                index_text(index);
+            }
+        }
+
+        vector<Recipe*> results;
+        for (const TextIndex::Hit& hit : textIndex->search(text, k)) {
+            results.push_back(recipes[slots[hit.slot].denseIndex]);
+        }
+        return results;
+    }
+
+    // The k recipes missing the fewest ingredients from pantry, and no more
+    // than maxMissing, fewest first; among equals, those using more of the
+    // pantry come first, then by slot. The pantry becomes a bitset over
+    // ingredient IDs that the store's ingredient column is checked against
+    // in parallel, so the cost is one pass over the store whatever the
+    // pantry holds.
+    vector<PantryMatch> recipes_from_pantry(const vector<string>& pantry, size_t k, uint32_t maxMissing = UINT32_MAX) const {
+        if (k == 0) {
+            return vector<PantryMatch>();
+        }
+        const IngredientTable& table = IngredientTable::instance();
+        vector<uint64_t> stocked((table.size() + 63) / 64, 0);
+        for (const string& item : pantry) {
+            IngredientId id = table.find(item);
+            if (id != IngredientTable::npos) {
+                stocked[id / 64] |= uint64_t(1) << (id % 64);
+            }
+        }
+
+        const size_t rowCount = store.size();
+        vector<uint32_t> missing(rowCount);
+        parallel_for(rowCount, [&](size_t row) {
+            uint32_t absent = 0;
+            for (IngredientId id : store.ingredients(row)) {
+                absent += static_cast<uint32_t>(~stocked[id / 64] >> (id % 64) & 1);
+            }
+            missing[row] = absent;
+        });
+
+        // The best k so far, kept as a heap with the weakest on top
+        struct Candidate {
+            uint32_t missing;
+            uint32_t ingredientCount;
+            uint32_t slot;
+            uint32_t row;
+        };
+        auto better = [](const Candidate& a, const Candidate& b) {
+            if (a.missing != b.missing) {
+                return a.missing < b.missing;
+            }
+            if (a.ingredientCount != b.ingredientCount) {
+                return a.ingredientCount > b.ingredientCount;
+            }
+            return a.slot < b.slot;
+        };
+        vector<Candidate> best;
+        best.reserve(k);
+        for (size_t row = 0; row < rowCount; ++row) {
+            // Most rows are ruled out on the count alone, without touching the recipe
+            if (missing[row] > maxMissing || (best.size() == k && missing[row] > best.front().missing)) {
+                continue;
+            }
+            Candidate candidate = { missing[row], static_cast<uint32_t>(store.ingredients(row).size()), recipes[row]->handle.index, static_cast<uint32_t>(row) };
+            if (best.size() < k) {
+                best.push_back(candidate);
+                push_heap(best.begin(), best.end(), better);
+            }
+            else if (better(candidate, best.front())) {
+                pop_heap(best.begin(), best.end(), better);
+                best.back() = candidate;
+                push_heap(best.begin(), best.end(), better);
+            }
+        }
+
+        sort(best.begin(), best.end(), better);
+        vector<PantryMatch> matches;
+        matches.reserve(best.size());
+        for (const Candidate& candidate : best) {
+            matches.push_back(PantryMatch{ recipes[candidate.row], candidate.missing, candidate.ingredientCount });
+        }
+        return matches;
+    }
+
+    // Recipes meeting every condition of query, in the order the chosen
+    // access path yields them. See plan_query for how that is chosen and
+    // explain_query to see the choice.
+    vector<Recipe*> run_query(const RecipeQuery& query) const {
+        const QueryPlan plan = plan_query(query);
+        vector<Recipe*> results;
+        if (plan.path == AccessPath::Empty) {
+            return results;
+        }
+        results.reserve(plan.filters.empty() ? plan.estimate : 0);
+
+        vector<uint32_t> batch;
+        batch.reserve(query_batch);
+        auto flush = [&]() {
+            for (const QueryFilter& filter : plan.filters) {
+                filter_rows(filter, plan, batch);
+            }
+            for (uint32_t row : batch) {
+                results.push_back(recipes[row]);
+            }
+            batch.clear();
+        };
+        auto candidate = [&](uint32_t row) {
+            batch.push_back(row);
+            if (batch.size() == query_batch) {
+                flush();
+            }
+        };
+
+        switch (plan.path) {
+        case AccessPath::Ingredient:
+            ingredientIndex[plan.id].for_each([&](uint32_t slot) {
+                candidate(slots[slot].denseIndex);
+            });
+            break;
+        case AccessPath::Category:
+            for (RecipeHandle handle : categories.recipes(plan.id)) {
+                candidate(slots[handle.index].denseIndex);
+            }
+            break;
+        case AccessPath::CookingTime:
+            scan_cooking_times(plan.minMinutes, plan.maxMinutes, [&](uint32_t slot) {
+                candidate(slots[slot].denseIndex);
+                return true;
+            });
+            break;
+        default:
+            for (uint32_t row = 0; row < recipes.size(); ++row) {
+                candidate(row);
+            }
+            break;
+        }
+        flush();
+        return results;
+    }
+
+    // Parse text as a RecipeQuery and run it. A query that does not parse
+    // matches nothing, with the reason in error if it is given.
+    vector<Recipe*> run_query(string_view text, string* error = nullptr) const {
+        RecipeQuery query;
+        if (!RecipeQuery::parse(text, query, error)) {
+            return vector<Recipe*>();
+        }
+        return run_query(query);
+    }
+
+    // How run_query would evaluate query: the access path with its
+    // estimated size, then the filters in the order they run
+    string explain_query(const RecipeQuery& query) const {
+        const QueryPlan plan = plan_query(query);
+        auto describe_time = [&]() {
+            string range = "time";
+            if (plan.minMinutes != INT_MIN) {
+                range += ">=" + to_string(plan.minMinutes);
+            }
+            if (plan.maxMinutes != INT_MAX) {
+                range += (plan.minMinutes != INT_MIN ? "," : "") + string("<=") + to_string(plan.maxMinutes);
+            }
+            return range;
+        };
+        auto describe = [&](QueryFilter::Field field, uint32_t id) {
+            switch (field) {
+            case QueryFilter::Field::Ingredient:
+                return "ingredient:" + IngredientTable::instance().name(id);
+            case QueryFilter::Field::Category:
+                return "category:" + categories.name(id);
+            default:
+                return describe_time();
+            }
+        };
+
+        string text;
+        switch (plan.path) {
+        case AccessPath::Empty:
+            return "empty";
+        case AccessPath::Ingredient:
+            text = "scan " + describe(QueryFilter::Field::Ingredient, plan.id);
+            break;
+        case AccessPath::Category:
+            text = "scan " + describe(QueryFilter::Field::Category, plan.id);
+            break;
+        case AccessPath::CookingTime:
+            text = "scan " + describe_time();
+            break;
+        default:
+            text = "scan all";
+            break;
+        }
+        text += " (" + to_string(plan.estimate) + ")";
+        for (const QueryFilter& filter : plan.filters) {
+            text += string(" | filter ") + (filter.negated ? "NOT " : "") + describe(filter.field, filter.id);
+        }
+        return text;
+    }
+
+    // Turn a bitmap of slot indexes back into recipes
+    vector<Recipe*> resolve(const RecipeBitmap& matches) const {
+        vector<Recipe*> result;
+        result.reserve(matches.cardinality());
+        matches.for_each([&](uint32_t slotIndex) {
+            result.push_back(recipes[slots[slotIndex].denseIndex]);
+        });
+        return result;
+    }
+
+
+
+    // Call fn on every recipe of one concrete type, passed as that type, so a
+    // homogeneous batch is processed without virtual calls
+    template <typename RecipeType, typename Function>
+    void for_each_recipe_of_kind(Function fn) const {
+        for (const Recipe* recipe : recipes) {
+            if (recipe->get_kind() == RecipeType::static_kind) {
+                fn(static_cast<const RecipeType&>(*recipe));
+            }
+        }
+    }
+
+    // Recipes taking between minMinutes and maxMinutes inclusive, fastest
+    // first, optionally restricted to one category
+    vector<Recipe*> recipes_by_cooking_time(int minMinutes, int maxMinutes, string_view category = string_view()) const {
+        vector<Recipe*> result;
+        CategoryId categoryId = CategoryIndex::no_category;
+        if (!category.empty()) {
+            categoryId = categories.find(category);
+            if (categoryId == CategoryIndex::no_category) {
+                return result;
+            }
+        }
+
+        scan_cooking_times(minMinutes, maxMinutes, [&](uint32_t slotIndex) {
+            uint32_t row = slots[slotIndex].denseIndex;
+            if (categoryId == CategoryIndex::no_category || store.category_id(row) == categoryId) {
+                result.push_back(recipes[row]);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    // The k quickest recipes, optionally restricted to one category
+    vector<Recipe*> fastest_recipes(size_t k, string_view category = string_view()) const {
+        vector<Recipe*> result;
+        CategoryId categoryId = CategoryIndex::no_category;
+        if (!category.empty()) {
+            categoryId = categories.find(category);
+            if (categoryId == CategoryIndex::no_category) {
+                return result;
+            }
+        }
+
+        scan_cooking_times(INT_MIN, INT_MAX, [&](uint32_t slotIndex) {
+            if (result.size() == k) {
+                return false;
+            }
+            uint32_t row = slots[slotIndex].denseIndex;
+            if (categoryId == CategoryIndex::no_category || store.category_id(row) == categoryId) {
+                result.push_back(recipes[row]);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    // Find recipes that take at most the given number of minutes
+    vector<Recipe*> filter_by_max_cooking_time(int minutes) const {
+        vector<Recipe*> result;
+        ArrayView<int> times = store.cooking_times();
+        for (size_t row = 0; row < times.size(); ++row) {
+            if (times[row] <= minutes) {
+                result.push_back(recipes[row]);
+            }
+        }
+        return result;
+    }
+
+    // Find recipes in a category by scanning the store's category column
+    vector<Recipe*> filter_by_category(string_view category) const {
+        vector<Recipe*> result;
+        CategoryId id = categories.find(category);
+        if (id == CategoryIndex::no_category) {
+            return result;
+        }
+
+        ArrayView<CategoryId> categories = store.category_ids();
+        for (size_t row = 0; row < categories.size(); ++row) {
+            if (categories[row] == id) {
+                result.push_back(recipes[row]);
+            }
+        }
+        return result;
+    }
+
+    // Delete a recipe by handle; returns false if the handle is stale
+    bool delete_recipe(RecipeHandle handle) {
+        if (!contains(handle)) {
+            return false;
+        }
+
+        remove_at(slots[handle.index].denseIndex);
+        return true;
+    }
+
+    // Change a recipe's cooking time in place, keeping its handle, and move
+    // it within the cooking-time index so range and fastest-first queries
+    // see the new time. Returns false for a stale handle.
+    bool set_cooking_time(RecipeHandle handle, int minutes) {
+        Recipe* recipe = get(handle);
+        if (recipe == nullptr) {
+            return false;
+        }
+
+        size_t index = slots[handle.index].denseIndex;
+        cookingTimeIndex.erase(make_pair(store.cooking_time(index), handle.index));
+        cookingTimeIndex.emplace(minutes, handle.index);
+        store.set_cooking_time(index, minutes);
+        recipe->cookingTime = minutes;
+        {
+            // A cached body copy would still have the old time
+            lock_guard<mutex> guard(bodyLock);
+            bodyCache.erase(handle.index);
+        }
+        mark_slot_dirty(handle.index);
+
+        if (log != nullptr) {
+            string record(1, static_cast<char>(LogOperation::SetCookingTime));
+            put_u32(record, handle.index);
+            put_u32(record, handle.generation);
+            put_u32(record, static_cast<uint32_t>(minutes));
+            logSequence = log->append(record);
+        }
+        return true;
+    }
+
+    // Delete a batch of recipes, compacting the category lists, the dense
+    // array and the store once rather than once per recipe. Stale and
+    // repeated handles are skipped. Returns how many recipes were deleted.
+    size_t delete_recipes(const vector<RecipeHandle>& batch) {
+        vector<char> doomedSlot(slots.size(), 0);
+        vector<char> doomedRow(recipes.size(), 0);
+        vector<RecipeHandle> doomed;
+
+        for (RecipeHandle handle : batch) {
+            if (!contains(handle) || doomedSlot[handle.index]) {
+                continue;
+            }
+
+            doomedSlot[handle.index] = 1;
+            size_t row = slots[handle.index].denseIndex;
+            doomedRow[row] = 1;
+            doomed.push_back(handle);
+            unindex_recipe(handle, row);
+        }
+
+        if (doomed.empty()) {
+            return 0;
+        }
+        log_delete(LogOperation::DeleteBatch, batch.data(), batch.size());
+
+        // Compact the category lists
+        categories.remove_if(
+            [&](RecipeHandle handle) { return doomedSlot[handle.index] != 0; },
+            [&](RecipeHandle handle, uint32_t position) { slots[handle.index].categoryPosition = position; });
+
+        // Compact the dense recipe array and the store alongside it
+        vector<Recipe*> doomedRecipes;
+        doomedRecipes.reserve(doomed.size());
+        store.remove_rows(doomedRow);
+        size_t kept = 0;
+        for (size_t row = 0; row < recipes.size(); ++row) {
+            if (doomedRow[row]) {
+                doomedRecipes.push_back(recipes[row]);
+                continue;
+            }
+            recipes[kept] = recipes[row];
+            slots[recipes[kept]->handle.index].denseIndex = static_cast<uint32_t>(kept);
+            ++kept;
+        }
+        recipes.resize(kept);
+
+        for (RecipeHandle handle : doomed) {
+            free_slot(handle);
+        }
+        for (Recipe* recipe : doomedRecipes) {
+            release_recipe(recipe);
+        }
+        return doomed.size();
+    }
+
+    // Delete a recipe. The pointer is looked up before it is dereferenced,
+    // so one that was already deleted or belongs to another book is only
+    // reported as not found.
+    void delete_recipe(Recipe* recipeToDelete) {
+        auto it = find(recipes.begin(), recipes.end(), recipeToDelete);
+        if (it != recipes.end()) {
+            remove_at(static_cast<size_t>(it - recipes.begin()));
+
+            cout << "Recipe deleted successfully.\n";
+        }
+        else {
+            cout << "Recipe not found.\n";
+        }
+    }
+
+    void delete_recipe(size_t index) {
+        // Ensure the index is within bounds
+        if (index < recipes.size()) {
+            remove_at(index);
+        }
+    }
+
+    // Write the book to path as a RecipeImage. The image is written to a
+    // temporary file first and renamed over path once complete, so a failed
+    // save leaves the previous image untouched.
+    bool save_image(const string& path) const {
+        return write_image(path, ImageSource(*this, false));
+    }
+
+    // Write only what changed since the last checkpoint, as a delta image
+    // that apply_delta can bring a copy of the last checkpoint up to date
+    // with. Not possible when needs_full_checkpoint() is true.
+    bool save_delta(const string& path) const {
+        if (needsFullCheckpoint) {
+            return false;
+        }
+        return write_image(path, ImageSource(*this, true));
+    }
+
+    // What save_image, or save_delta when delta is true, would write, copied
+    // out so it can be written after the book has moved on
+    ImageSnapshot snapshot(bool delta) const {
+        return ImageSnapshot(ImageSource(*this, delta && !needsFullCheckpoint));
+    }
+
+    // Add every recipe in an image to the book in one batch. Returns the
+    // number of recipes added. Loaded into an empty book, the recipes keep
+    // the handles they had when saved, which replay_log relies on.
+    size_t load_image(const RecipeImage& image) {
+        if (image.is_delta()) {
+            return 0;
+        }
+        return add_image_recipes(image, true).size();
+    }
+
+    // Load an image into an empty book keeping only each recipe's name,
+    // cooking time and category in its Recipe. The book keeps the image
+    // mapped and reads ingredients and steps from it on demand: full_recipe
+    // returns a cached copy, and a Recipe's own body accessors read the body
+    // into the Recipe the first time they are called. Ingredient IDs still
+    // go into the indexes and the store. Nothing is logged, as the image
+    // already holds the recipes. On Windows a mapped file cannot be
+    // replaced, so a lazily loaded book's image cannot be saved over; see
+    // CheckpointStore::recover.
+    size_t load_image_lazily(RecipeImage&& image) {
+        if (image.is_delta() || !recipes.empty()) {
+            return 0;
+        }
+        // The full-text index reads steps through bodyRows, which are only
+        // set up afterwards, so leave it to be rebuilt by the next search
+        textIndex.reset();
+        OperationLog* attached = log;
+        log = nullptr;
+        vector<RecipeHandle> handles = add_image_recipes(image, false);
+        log = attached;
+
+        bodyRows.assign(slots.size(), no_body_row);
+        for (uint32_t row = 0; row < handles.size(); ++row) {
+            bodyRows[handles[row].index] = row;
+        }
+        bodyImage.reset(new RecipeImage(std::move(image)));
+        for (const RecipeHandle& handle : handles) {
+            recipes[slots[handle.index].denseIndex]->bodySource.store(this, memory_order_release);
+        }
+        return handles.size();
+    }
+
+    // Read a lazily loaded recipe's ingredients and steps into the recipe
+    // itself. Called by its body accessors; later calls find it loaded.
+    void load_body(const Recipe& recipe) const {
+        lock_guard<mutex> guard(bodyLock);
+        if (recipe.bodySource.load(memory_order_relaxed) == nullptr) {
+            return;
+        }
+        // The recipe is one of the book's own, never a const object
+        Recipe& target = const_cast<Recipe&>(recipe);
+        uint32_t slot = recipe.handle.index;
+        ArrayView<IngredientId> ingredients = store.ingredients(slots[slot].denseIndex);
+        target.ingredientIds.assign(ingredients.begin(), ingredients.end());
+        uint32_t row = bodyRows[slot];
+        size_t stepCount = bodyImage->step_count(row);
+        target.steps.reserve(stepCount);
+        for (size_t i = 0; i < stepCount; ++i) {
+            string_view step = bodyImage->step(row, i);
+            target.steps.emplace_back(step.data(), step.size());
+        }
+        bodyCache.erase(slot);
+        recipe.bodySource.store(nullptr, memory_order_release);
+    }
+
+    // The recipe with its ingredients and steps: the recipe itself, or for
+    // a lazily loaded one a copy read from the image. The copy is shared
+    // with the cache, so it stays valid after being evicted.
+    shared_ptr<const Recipe> full_recipe(const Recipe* recipe) const {
+        uint32_t slot = recipe->handle.index;
+        if (slot >= bodyRows.size() || bodyRows[slot] == no_body_row || recipe->bodySource.load(memory_order_acquire) == nullptr) {
+            // Non-owning: the book keeps the recipe alive
+            return shared_ptr<const Recipe>(shared_ptr<const Recipe>(), recipe);
+        }
+
+        lock_guard<mutex> guard(bodyLock);
+        shared_ptr<const Recipe> cached = bodyCache.find(slot);
+        if (cached) {
+            return cached;
+        }
+
+        uint32_t row = bodyRows[slot];
+        unique_ptr<Recipe> loaded = make_empty_recipe(recipe->get_kind(), string(recipe_category(*recipe)));
+        loaded->name = recipe->name;
+        loaded->cookingTime = recipe->cookingTime;
+        loaded->handle = recipe->handle;
+        ArrayView<IngredientId> ingredients = store.ingredients(slots[slot].denseIndex);
+        loaded->ingredientIds.assign(ingredients.begin(), ingredients.end());
+        size_t stepCount = bodyImage->step_count(row);
+        loaded->steps.reserve(stepCount);
+        for (size_t i = 0; i < stepCount; ++i) {
+            string_view step = bodyImage->step(row, i);
+            loaded->steps.emplace_back(step.data(), step.size());
+        }
+
+        shared_ptr<const Recipe> body(std::move(loaded));
+        bodyCache.insert(slot, body);
+        return body;
+    }
+
+    // How many lazily loaded bodies full_recipe keeps cached
+    void set_body_cache_size(size_t entries) {
+        lock_guard<mutex> guard(bodyLock);
+        bodyCache.set_capacity(entries);
+    }
+
+    bool has_lazy_bodies() const {
+        return bodyImage != nullptr;
+    }
+
+    // Bring the book up to date with a delta from save_delta. The delta must
+    // be the checkpoint right after the book's current one; if it is not,
+    // nothing changes and false is returned.
+    bool apply_delta(const RecipeImage& delta) {
+        if (!delta.is_delta() || delta.checkpoint() != checkpointNumber + 1 || delta.first_category() != categories.size()
+            || delta.slot_count() < slots.size() || !image_slots_valid(delta)) {
+            return false;
+        }
+
+        OperationLog* attached = log;
+        log = nullptr;
+
+        for (CategoryId id = delta.first_category(); id < delta.first_category() + delta.category_count(); ++id) {
+            categories.intern(delta.category_name(id));
+        }
+
+        // Take out the recipes in every slot the delta rewrites
+        vector<RecipeHandle> replaced;
+        for (size_t i = 0; i < delta.changed_slot_count(); ++i) {
+            uint32_t slot = delta.changed_slot(i);
+            if (slot < slots.size() && liveRecipes.contains(slot)) {
+                replaced.push_back(RecipeHandle(slot, slots[slot].generation));
+            }
+        }
+        delete_recipes(replaced);
+
+        slots.resize(delta.slot_count(), Slot{ 0, 0, 0 });
+        for (size_t i = 0; i < delta.changed_slot_count(); ++i) {
+            slots[delta.changed_slot(i)].generation = delta.slot_generation(i);
+        }
+
+        vector<IngredientId> ingredientMap = map_image_ingredients(delta);
+        vector<Recipe*> batch;
+        batch.reserve(delta.size());
+        for (size_t row = 0; row < delta.size(); ++row) {
+            CategoryId categoryId = delta.category_id(row);
+            string category = categoryId < categories.size() ? categories.name(categoryId) : string();
+            batch.push_back(recipe_from_image(delta, row, ingredientMap, category));
+        }
+
+        freeSlots.clear();
+        queue_image_slots(delta);
+        add_recipes(batch);
+        ArrayView<uint32_t> savedFreeSlots = delta.free_slots();
+        freeSlots.assign(savedFreeSlots.begin(), savedFreeSlots.end());
+
+        checkpointNumber = delta.checkpoint();
+        logSequence = max(logSequence, delta.log_sequence());
+        log = attached;
+        return true;
+    }
+
+    // Whether the next checkpoint has to be a whole image: the book has not
+    // been checkpointed or recovered from one yet, or has been cleared since
+    bool needs_full_checkpoint() const {
+        return needsFullCheckpoint;
+    }
+
+    // Make the next checkpoint a whole image, as when a delta the book was
+    // marked checkpointed for never reached the disk
+    void require_full_checkpoint() {
+        needsFullCheckpoint = true;
+    }
+
+    bool has_unsaved_changes() const {
+        return needsFullCheckpoint || !dirtySlots.empty() || categories.size() != checkpointCategories;
+    }
+
+    uint64_t checkpoint_number() const {
+        return checkpointNumber;
+    }
+
+    // Record that the book as it stands is checkpoint `number` on disk, so
+    // the next delta starts from here
+    void mark_checkpointed(uint64_t number) {
+        for (uint32_t slot : dirtySlots) {
+            slotDirty[slot] = 0;
+        }
+        dirtySlots.clear();
+        checkpointCategories = categories.size();
+        needsFullCheckpoint = false;
+        checkpointNumber = number;
+    }
+
+    // Record additions and deletions in newLog from now on, or stop recording
+    // if it is nullptr. Replay any existing records with replay_log first.
+    void attach_log(OperationLog* newLog) {
+        log = newLog;
+        if (log != nullptr) {
+            log->skip_to(logSequence);
+        }
+    }
+
+    // Redo the operations in log that the book does not have yet, such as
+    // those made after the last save_image by a run that then crashed.
+    // Returns the number of records applied.
+    size_t replay_log(const OperationLog& source) {
+        OperationLog* attached = log;
+        log = nullptr;
+        size_t applied = 0;
+        source.replay([&](uint64_t sequence, string_view record) {
+            if (sequence <= logSequence) {
+                return;
+            }
+            if (apply_log_record(record)) {
+                ++applied;
+            }
+            logSequence = sequence;
+        });
+        log = attached;
+        return applied;
+    }
+
+    // Sequence number of the last logged operation the book reflects
+    uint64_t log_sequence() const {
+        return logSequence;
+    }
+
+    // Remove every recipe
+    void clear() {
+        string record(1, static_cast<char>(LogOperation::Clear));
+        if (log != nullptr) {
+            logSequence = log->append(record);
+        }
+        release_all();
+    }
+
+    // Remove every recipe without logging it. Arena-backed recipes are
+    // dropped together with the arena's blocks rather than destroyed one at
+    // a time.
+    void release_all() {
+        for (Recipe* recipe : recipes) {
+            if (!owned_by_arena(recipe)) {
+                delete recipe;
+            }
+        }
+        recipes.clear();
+        slots.clear();
+        freeSlots.clear();
+        categories.clear();
+        ingredientIndex.clear();
+        liveRecipes.clear();
+        cookingTimeIndex.clear();
+        store = RecipeStore();
+        textIndex.reset();
+
+        bodyRows.clear();
+        bodyImage.reset();
+        {
+            lock_guard<mutex> guard(bodyLock);
+            bodyCache.clear();
+        }
+
+        dirtySlots.clear();
+        slotDirty.clear();
+        checkpointCategories = 0;
+        needsFullCheckpoint = true;
+
+        if (arena) {
+            pool->release();
+            arena->release();
+        }
+    }
+
+    void display_all_categories() const {
+        cout << "Categories:\n";
+        cout << "1. All\n";
+        for (CategoryId id = 0; id < categories.size(); ++id) {
+            cout << id + 2 << ". " << categories.name(id) << "\n";
+        }
+    }
+
+};
+
+inline void Recipe::load_body() const {
+    const RecipeBook* book = bodySource.load(memory_order_acquire);
+    if (book != nullptr) {
+        book->load_body(*this);
+    }
+}
+
+
+
+// A base image with a run of deltas applied, presented as one whole image
+// to RecipeImage::write. Merging this way works on the files alone and
+// never touches a RecipeBook or the process-wide ingredient table.
+class MergedImageSource {
+private:
+    struct Row {
+        uint32_t image;
+        uint32_t index;
+        uint32_t slot;
+    };
+
+    static constexpr uint32_t no_image = UINT32_MAX;
+
+    // The base first, then the deltas in order
+    vector<const RecipeImage*> images;
+    // Surviving rows in slot order
+    vector<Row> rows;
+    vector<uint32_t> generations;
+    vector<string_view> categoryNames;
+    // One merged ingredient vocabulary, and each image's IDs translated into it
+    vector<string_view> ingredientNames;
+    vector<vector<IngredientId>> ingredientMaps;
+    bool consistent;
+
+public:
+    MergedImageSource(const RecipeImage& base, const deque<RecipeImage>& deltas) : consistent(true) {
+        images.push_back(&base);
+        for (const RecipeImage& delta : deltas) {
+            images.push_back(&delta);
+        }
+
+        size_t slotCount = 0;
+        for (const RecipeImage* image : images) {
+            slotCount = max(slotCount, image->slot_count());
+        }
+
+        // Later images overwrite the slots they change
+        vector<pair<uint32_t, uint32_t>> owner(slotCount, make_pair(no_image, uint32_t(0)));
+        generations.assign(slotCount, 0);
+        for (uint32_t source = 0; source < images.size(); ++source) {
+            const RecipeImage& image = *images[source];
+            if (image.first_category() != categoryNames.size()) {
+                consistent = false;
+            }
+            for (CategoryId id = image.first_category(); id < image.first_category() + image.category_count(); ++id) {
+                categoryNames.push_back(image.category_name(id));
+            }
+
+            if (image.is_delta()) {
+                for (size_t i = 0; i < image.changed_slot_count(); ++i) {
+                    uint32_t slot = image.changed_slot(i);
+                    if (slot >= slotCount) {
+                        consistent = false;
+                        continue;
+                    }
+                    owner[slot].first = no_image;
+                    generations[slot] = image.slot_generation(i);
+                }
+            }
+            else {
+                for (size_t slot = 0; slot < image.slot_count(); ++slot) {
+                    generations[slot] = image.slot_generation(slot);
+                }
+            }
+
+            for (uint32_t row = 0; row < image.size(); ++row) {
+                uint32_t slot = image.slot(row);
+                if (slot >= slotCount) {
+                    consistent = false;
+                    continue;
+                }
+                owner[slot] = make_pair(source, row);
+            }
+        }
+
+        for (uint32_t slot = 0; slot < slotCount; ++slot) {
+            if (owner[slot].first != no_image) {
+                rows.push_back(Row{ owner[slot].first, owner[slot].second, slot });
+            }
+        }
+
+        unordered_map<string_view, IngredientId> ingredientIds;
+        for (const RecipeImage* image : images) {
+            vector<IngredientId> ingredientMap(image->ingredient_count());
+            for (IngredientId id = 0; id < ingredientMap.size(); ++id) {
+                string_view name = image->ingredient_name(id);
+                auto it = ingredientIds.emplace(name, static_cast<IngredientId>(ingredientNames.size())).first;
+                if (it->second == ingredientNames.size()) {
+                    ingredientNames.push_back(name);
+                }
+                ingredientMap[id] = it->second;
+            }
+            ingredientMaps.push_back(std::move(ingredientMap));
+        }
+    }
+
+    // False if the images do not fit together, such as a delta whose
+    // categories do not follow on from the ones before it
+    bool valid() const {
+        return consistent;
+    }
+
+    bool is_delta() const {
+        return false;
+    }
+
+    uint64_t checkpoint() const {
+        return images.back()->checkpoint();
+    }
+
+    uint64_t log_sequence() const {
+        return images.back()->log_sequence();
+    }
+
+    size_t size() const {
+        return rows.size();
+    }
+
+    string_view name(size_t row) const {
+        return images[rows[row].image]->name(rows[row].index);
+    }
+
+    int cooking_time(size_t row) const {
+        return images[rows[row].image]->cooking_time(rows[row].index);
+    }
+
+    CategoryId category_id(size_t row) const {
+        return images[rows[row].image]->category_id(rows[row].index);
+    }
+
+    RecipeKind kind(size_t row) const {
+        return images[rows[row].image]->kind(rows[row].index);
+    }
+
+    uint32_t slot(size_t row) const {
+        return rows[row].slot;
+    }
+
+    size_t ingredient_count(size_t row) const {
+        size_t count = 0;
+        for_each_ingredient(row, [&count](IngredientId) { ++count; });
+        return count;
+    }
+
+    template <typename Function>
+    void for_each_ingredient(size_t row, Function fn) const {
+        const vector<IngredientId>& ingredientMap = ingredientMaps[rows[row].image];
+        for (IngredientId id : images[rows[row].image]->ingredients(rows[row].index)) {
+            if (id < ingredientMap.size()) {
+                fn(ingredientMap[id]);
+            }
+        }
+    }
+
+    size_t step_count(size_t row) const {
+        return images[rows[row].image]->step_count(rows[row].index);
+    }
+
+    string_view step(size_t row, size_t i) const {
+        return images[rows[row].image]->step(rows[row].index, i);
+    }
+
+    size_t ingredient_space() const {
+        return ingredientNames.size();
+    }
+
+    string_view ingredient_name(IngredientId id) const {
+        return ingredientNames[id];
+    }
+
+    CategoryId first_category() const {
+        return 0;
+    }
+
+    size_t category_count() const {
+        return categoryNames.size();
+    }
+
+    string_view category_name(CategoryId id) const {
+        return categoryNames[id];
+    }
+
+    size_t slot_count() const {
+        return generations.size();
+    }
+
+    size_t changed_slot_count() const {
+        return 0;
+    }
+
+    uint32_t changed_slot(size_t) const {
+        return 0;
+    }
+
+    uint32_t slot_generation(size_t i) const {
+        return generations[i];
+    }
+
+    // The free list as the newest image left it
+    ArrayView<uint32_t> free_slots() const {
+        return images.back()->free_slots();
+    }
+};
+
+// A book's checkpoints on disk: a base image at basePath and the deltas
+// written since, each beside it as <base>.<checkpoint number>.delta. A
+// checkpoint writes only what changed; merge() folds the deltas into a new
+// base on a background thread, so recovery reads about as much as the book
+// holds however long its history.
+class CheckpointStore {
+private:
+    // A snapshot waiting for the save thread, and where it goes
+    struct SaveJob {
+        ImageSnapshot snapshot;
+        string path;
+    };
+
+    string basePath;
+    thread merger;
+    atomic<bool> merging;
+    // Held while the base image is being replaced, by a merge or a save
+    mutex baseLock;
+
+    thread saver;
+    mutex saveLock;
+    condition_variable saveWake;
+    condition_variable saveIdle;
+    deque<unique_ptr<SaveJob>> saveQueue;
+    bool saving;
+    bool stopping;
+    // A save failed, so the deltas after it have nothing to build on
+    bool chainBroken;
+    // A whole image to repair the chain is queued
+    bool repairQueued;
+    // A save failed since the last flush()
+    bool saveFailed;
+
+    string delta_path(uint64_t checkpoint) const {
+        char number[21];
+        snprintf(number, sizeof(number), "%020llu", static_cast<unsigned long long>(checkpoint));
+        return basePath + "." + number + ".delta";
+    }
+
+    // Paths of the deltas beside the base, oldest first
+    vector<string> delta_paths() const {
+        filesystem::path base(basePath);
+        filesystem::path directory = base.parent_path().empty() ? filesystem::path(".") : base.parent_path();
+        const string prefix = base.filename().string() + ".";
+        const string suffix = ".delta";
+        const size_t nameLength = prefix.size() + 20 + suffix.size();
+
+        vector<string> paths;
+        error_code error;
+        for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            string name = it->path().filename().string();
+            if (name.size() == nameLength && name.compare(0, prefix.size(), prefix) == 0 && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+                paths.push_back(it->path().string());
+            }
+        }
+        // The numbers are zero-padded, so this orders them numerically
+        sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    // Where a replaced base is kept, for recover to fall back on should the
+    // newer one be damaged
+    static string previous_path(const string& basePath) {
+        return basePath + ".prev";
+    }
+
+    // Move a sound base aside as the previous one before it is replaced. A
+    // damaged base is left to be overwritten, so it never displaces a good
+    // previous one.
+    static bool retire_base(const string& basePath) {
+        RecipeImage base;
+        if (!base.open(basePath) || base.is_delta()) {
+            return true;
+        }
+        base.close();
+        return replace_file(basePath, previous_path(basePath)) && sync_parent_directory(basePath);
+    }
+
+    // Open the base, or the previous one if the base is missing or damaged;
+    // usedPrevious says which
+    bool open_base(RecipeImage& image, bool& usedPrevious) const {
+        usedPrevious = false;
+        if (image.open(basePath) && !image.is_delta()) {
+            return true;
+        }
+        usedPrevious = true;
+        return image.open(previous_path(basePath)) && !image.is_delta();
+    }
+
+    // Write the base and the unbroken run of deltas after it as a new base,
+    // then delete the deltas it now holds
+    static bool merge_files(const string& basePath, const vector<string>& deltaPaths) {
+        RecipeImage base;
+        if (!base.open(basePath) || base.is_delta()) {
+            return false;
+        }
+
+        deque<RecipeImage> deltas;
+        vector<pair<string, uint64_t>> absorbed;
+        for (const string& path : deltaPaths) {
+            RecipeImage delta;
+            if (!delta.open(path) || !delta.is_delta()) {
+                break;
+            }
+            uint64_t expected = deltas.empty() ? base.checkpoint() + 1 : deltas.back().checkpoint() + 1;
+            if (delta.checkpoint() < expected) {
+                // Left over from an earlier merge that stopped before deleting it
+                absorbed.emplace_back(path, delta.checkpoint());
+                continue;
+            }
+            if (delta.checkpoint() != expected) {
+                break;
+            }
+            absorbed.emplace_back(path, delta.checkpoint());
+            deltas.push_back(std::move(delta));
+        }
+        if (deltas.empty()) {
+            return true;
+        }
+
+        MergedImageSource source(base, deltas);
+        string temporaryPath = basePath + ".merge";
+        if (!source.valid() || !RecipeImage::write(temporaryPath, source)) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+
+        // Unmap everything before replacing and deleting the files. The
+        // deltas go only once the new base is synced, so a crash before
+        // then leaves the old base and its deltas to recover from.
+        base.close();
+        deltas.clear();
+        if (!retire_base(basePath) || !replace_file_durably(temporaryPath, basePath)) {
+            remove(temporaryPath.c_str());
+            return false;
+        }
+        for (auto it = absorbed.rbegin(); it != absorbed.rend(); ++it) {
+            remove(it->first.c_str());
+        }
+        return true;
+    }
+
+    // Write one queued snapshot. A base replaces every delta on disk, as
+    // jobs are written in order and so all of them are older; they are
+    // deleted only once the base is synced.
+    bool write_job(const SaveJob& job) {
+        if (job.snapshot.is_delta()) {
+            return job.snapshot.write(job.path);
+        }
+        lock_guard<mutex> guard(baseLock);
+        if (!retire_base(job.path) || !job.snapshot.write(job.path)) {
+            return false;
+        }
+        for (const string& path : delta_paths()) {
+            remove(path.c_str());
+        }
+        return true;
+    }
+
+    // The save thread: write jobs in the order they were queued until told
+    // to stop with the queue empty
+    void save_loop() {
+        unique_lock<mutex> guard(saveLock);
+        while (true) {
+            saveWake.wait(guard, [this]() { return stopping || !saveQueue.empty(); });
+            if (saveQueue.empty()) {
+                return;
+            }
+            unique_ptr<SaveJob> job = std::move(saveQueue.front());
+            saveQueue.pop_front();
+            const bool full = !job->snapshot.is_delta();
+            // Deltas queued behind a failed save would only lengthen a broken
+            // chain; a whole image queued after them repairs it
+            const bool skip = chainBroken && !full;
+            saving = true;
+            guard.unlock();
+
+            bool written = !skip && write_job(*job);
+            job.reset();
+
+            guard.lock();
+            saving = false;
+            if (full) {
+                repairQueued = false;
+            }
+            if (!written) {
+                chainBroken = true;
+                saveFailed = true;
+            }
+            else if (full) {
+                chainBroken = false;
+            }
+            saveIdle.notify_all();
+        }
+    }
+
+public:
+    explicit CheckpointStore(const string& path)
+        : basePath(path), merging(false), saving(false), stopping(false), chainBroken(false), repairQueued(false), saveFailed(false) {}
+
+    CheckpointStore(const CheckpointStore&) = delete;
+    CheckpointStore& operator=(const CheckpointStore&) = delete;
+
+    ~CheckpointStore() {
+        {
+            lock_guard<mutex> guard(saveLock);
+            stopping = true;
+        }
+        saveWake.notify_all();
+        if (saver.joinable()) {
+            saver.join();
+        }
+        wait_for_merge();
+    }
+
+    // Load the base image and the deltas after it into an empty book. A
+    // base that is missing or fails its checksum gives way to the previous
+    // one; returns false if neither is usable, leaving the log to rebuild
+    // from. With lazyBodies the base is loaded with
+    // RecipeBook::load_image_lazily, except on Windows, where the mapping
+    // would keep the base from ever being replaced.
+    //
+    // Deltas after a break in the chain, or built on a base that had to be
+    // given up, are renamed out of the way (to .delta.unused) so new deltas
+    // cannot take their numbers, and the next checkpoint is a whole image.
+    bool recover(RecipeBook& book, bool lazyBodies = false) {
+        wait_for_merge();
+        RecipeImage image;
+        bool usedPrevious = false;
+        if (!open_base(image, usedPrevious)) {
+            return false;
+        }
+#ifdef _WIN32
+        // Windows cannot rename or replace a mapped file, so a base kept
+        // mapped for its bodies would block every later full checkpoint
+        // and merge. Load it whole instead.
+        lazyBodies = false;
+#endif
+        if (lazyBodies) {
+            book.load_image_lazily(std::move(image));
+        }
+        else {
+            book.load_image(image);
+            image.close();
+        }
+
+        vector<string> unused;
+        for (const string& path : delta_paths()) {
+            RecipeImage delta;
+            bool opened = delta.open(path);
+            if (opened && delta.checkpoint() <= book.checkpoint_number()) {
+                // Already in the base, left over from a merge
+                continue;
+            }
+            // Each delta builds on the one before, so a missing or damaged
+            // one ends the run and leaves the rest unused
+            if (!unused.empty() || !opened || !book.apply_delta(delta)) {
+                unused.push_back(path);
+            }
+        }
+        for (const string& path : unused) {
+            replace_file(path, path + ".unused");
+        }
+        if (!unused.empty()) {
+            sync_parent_directory(basePath);
+        }
+
+        book.mark_checkpointed(book.checkpoint_number());
+        if (usedPrevious || !unused.empty()) {
+            book.require_full_checkpoint();
+        }
+        return true;
+    }
+
+    // Save the book's changes since its last checkpoint: a delta normally,
+    // or a new base image when the book has nothing on disk to build on.
+    // Any saves still queued by checkpoint_async are written first.
+    bool checkpoint(RecipeBook& book) {
+        flush();
+        {
+            lock_guard<mutex> guard(saveLock);
+            if (chainBroken) {
+                book.require_full_checkpoint();
+            }
+        }
+
+        uint64_t number = book.checkpoint_number() + 1;
+        if (book.needs_full_checkpoint()) {
+            wait_for_merge();
+            lock_guard<mutex> guard(baseLock);
+            if (!retire_base(basePath) || !book.save_image(basePath)) {
+                return false;
+            }
+            {
+                lock_guard<mutex> saveGuard(saveLock);
+                chainBroken = false;
+            }
+            book.mark_checkpointed(number);
+
+            // Older deltas are either in the new base or belong to a history it replaces
+            for (const string& path : delta_paths()) {
+                remove(path.c_str());
+            }
+            return true;
+        }
+
+        if (!book.has_unsaved_changes()) {
+            return true;
+        }
+        if (!book.save_delta(delta_path(number))) {
+            return false;
+        }
+        book.mark_checkpointed(number);
+        return true;
+    }
+
+    // checkpoint() without the disk I/O: the changes are copied out here
+    // and written by a background thread, in order with earlier saves, so
+    // the caller never waits on the disk. The book counts as checkpointed
+    // at once. If a save fails, later deltas are dropped and the next call
+    // queues a whole image instead; flush() reports the failure.
+    void checkpoint_async(RecipeBook& book) {
+        unique_lock<mutex> guard(saveLock);
+        if (chainBroken && !repairQueued) {
+            book.require_full_checkpoint();
+        }
+        if (!book.has_unsaved_changes()) {
+            return;
+        }
+
+        const bool full = book.needs_full_checkpoint();
+        const uint64_t number = book.checkpoint_number() + 1;
+        unique_ptr<SaveJob> job(new SaveJob{ book.snapshot(!full), full ? basePath : delta_path(number) });
+        book.mark_checkpointed(number);
+        if (full) {
+            repairQueued = true;
+        }
+
+        saveQueue.push_back(std::move(job));
+        if (!saver.joinable()) {
+            saver = thread(&CheckpointStore::save_loop, this);
+        }
+        guard.unlock();
+        saveWake.notify_one();
+    }
+
+    // Wait until every save queued by checkpoint_async is on disk. Returns
+    // false if any of them failed since the last flush.
+    bool flush() {
+        unique_lock<mutex> guard(saveLock);
+        saveIdle.wait(guard, [this]() { return saveQueue.empty() && !saving; });
+        bool succeeded = !saveFailed;
+        saveFailed = false;
+        return succeeded;
+    }
+
+    // Start folding the deltas into the base on a background thread, if
+    // there are at least minimumDeltas of them and no merge is running
+    void merge(size_t minimumDeltas = 1) {
+        if (merging) {
+            return;
+        }
+        wait_for_merge();
+
+        vector<string> deltas = delta_paths();
+        if (deltas.empty() || deltas.size() < minimumDeltas) {
+            return;
+        }
+        merging = true;
+        merger = thread([this, deltas]() {
+            lock_guard<mutex> guard(baseLock);
+            merge_files(basePath, deltas);
+            merging = false;
+        });
+    }
+
+    void wait_for_merge() {
+        if (merger.joinable()) {
+            merger.join();
+        }
+    }
+
+    size_t delta_count() const {
+        return delta_paths().size();
+    }
+};
+
+// First '"' or '\\' in [p, end), or end. Compares 16 bytes at a time with
+// SSE2 where it is available.
+inline const char* find_quote_or_escape(const char* p, const char* end) {
+#ifdef RECIPE_BOOK_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)));
+        if (mask != 0) {
+            return p + lowest_bit(static_cast<uint64_t>(mask));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') {
+        ++p;
+    }
+    return p;
+}
+
+// Outcome of an import
+struct ImportStats {
+    size_t imported;
+    size_t rejected;
+    // 1-based line (or row) number of the first rejected record, 0 if none
+    size_t firstRejectedLine;
+};
+
+// A recipe as parsed by an importer. Its strings point into the input, or
+// into the chunk it was parsed into.
+struct ImportedRecipe {
+    string_view name;
+    string_view category;
+    RecipeKind kind;
+    int cookingTime;
+    // Ranges of the chunk's texts
+    uint32_t firstIngredient;
+    uint32_t ingredientCount;
+    uint32_t firstStep;
+    uint32_t stepCount;
+};
+
+// What one thread parsed from its share of the input
+struct ImportChunk {
+    vector<ImportedRecipe> recipes;
+    vector<string_view> texts;
+    // Copies of strings that differ from the input, such as unescaped ones
+    pmr::monotonic_buffer_resource copies;
+    // Lines (or rows) seen, including rejected and blank ones
+    size_t lines;
+    size_t rejected;
+    // 1-based within the chunk
+    size_t firstRejectedLine;
+
+    ImportChunk() : lines(0), rejected(0), firstRejectedLine(0) {}
+
+    string_view keep(string_view text) {
+        char* copy = static_cast<char*>(copies.allocate(text.size() + 1, 1));
+        std::copy(text.begin(), text.end(), copy);
+        return string_view(copy, text.size());
+    }
+
+    void reject() {
+        if (rejected++ == 0) {
+            firstRejectedLine = lines;
+        }
+    }
+};
+
+// Split [first, last) into up to shares ranges of roughly equal size.
+// boundary(start, cut) gives the start of the first record at or after cut,
+// scanning from the record start at start if it needs to.
+template <typename Boundary>
+vector<pair<const char*, const char*>> split_input(const char* first, const char* last, size_t shares, Boundary boundary) {
+    const size_t minimumShare = 256 * 1024;
+    shares = max<size_t>(1, min(shares, static_cast<size_t>(last - first) / minimumShare));
+    vector<pair<const char*, const char*>> ranges;
+    const char* start = first;
+    for (size_t i = 1; i < shares && start < last; ++i) {
+        const char* cut = first + (last - first) * i / shares;
+        if (cut < start) {
+            continue;
+        }
+        const char* next = boundary(start, cut);
+        if (next >= last) {
+            break;
+        }
+        ranges.emplace_back(start, next);
+        start = next;
+    }
+    if (start < last) {
+        ranges.emplace_back(start, last);
+    }
+    return ranges;
+}
+
+// Run parse(first, last, chunk) for each range, each on its own thread and
+// into its own chunk
+template <typename Parse>
+deque<ImportChunk> parse_chunks(const vector<pair<const char*, const char*>>& ranges, Parse parse) {
+    deque<ImportChunk> chunks(ranges.size());
+    vector<thread> workers;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        workers.emplace_back([&ranges, &chunks, &parse, i]() {
+            parse(ranges[i].first, ranges[i].second, chunks[i]);
+        });
+    }
+    if (!ranges.empty()) {
+        parse(ranges[0].first, ranges[0].second, chunks[0]);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return chunks;
+}
+
+// Build the recipes in chunks and add them to the book in input order.
+// linesBefore is the number of lines that came before the first chunk.
+inline void add_imported_recipes(deque<ImportChunk>& chunks, RecipeBook& book, ImportStats& stats, size_t& linesBefore) {
+    // Building recipes interns ingredients, so it happens on this thread
+    IngredientTable& table = IngredientTable::instance();
+    string category;
+    string ingredient;
+    vector<Recipe*> batch;
+    for (ImportChunk& chunk : chunks) {
+        for (const ImportedRecipe& imported : chunk.recipes) {
+            category.assign(imported.category.data(), imported.category.size());
+            Recipe* recipe = book.create_recipe(imported.kind, category);
+            recipe->name.assign(imported.name.data(), imported.name.size());
+            recipe->cookingTime = imported.cookingTime;
+
+            recipe->ingredientIds.reserve(imported.ingredientCount);
+            for (uint32_t i = 0; i < imported.ingredientCount; ++i) {
+                string_view text = chunk.texts[imported.firstIngredient + i];
+                ingredient.assign(text.data(), text.size());
+                recipe->ingredientIds.push_back(table.intern(ingredient));
+            }
+            recipe->steps.reserve(imported.stepCount);
+            for (uint32_t i = 0; i < imported.stepCount; ++i) {
+                string_view text = chunk.texts[imported.firstStep + i];
+                recipe->steps.emplace_back(text.data(), text.size());
+            }
+            batch.push_back(recipe);
+        }
+
+        if (chunk.rejected != 0 && stats.firstRejectedLine == 0) {
+            stats.firstRejectedLine = linesBefore + chunk.firstRejectedLine;
+        }
+        stats.rejected += chunk.rejected;
+        linesBefore += chunk.lines;
+    }
+
+    book.add_recipes(batch);
+    stats.imported += batch.size();
+}
+
+// Streams recipes from JSON Lines into a RecipeBook, one object per line:
+//
+//   {"name": "...", "ingredients": ["..."], "steps": ["..."], "cookingTime": 25, "cuisine": "Italian"}
+//
+// A "cuisine" makes a main course and a "type" a dessert; other keys are
+// skipped. The input is read in blocks cut at line ends. Each block is split
+// across threads, which parse straight from the block into flat records
+// whose strings point into it, copying only strings with escapes in them.
+// The records are then built into recipes and added with add_recipes, a
+// block at a time, so memory stays around the block size.
+class JsonLinesImporter {
+private:
+
+    // Recursive-descent parser over one line
+    class Parser {
+    private:
+        const char* p;
+        const char* end;
+        ImportChunk& chunk;
+
+        void skip_whitespace() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+                ++p;
+            }
+        }
+
+        bool consume(char expected) {
+            skip_whitespace();
+            if (p < end && *p == expected) {
+                ++p;
+                return true;
+            }
+            return false;
+        }
+
+        static int hex_value(char c) {
+            if (c >= '0' && c <= '9') {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f') {
+                return c - 'a' + 10;
+            }
+            if (c >= 'A' && c <= 'F') {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+
+        bool parse_hex4(uint32_t& value) {
+            if (end - p < 4) {
+                return false;
+            }
+            value = 0;
+            for (int i = 0; i < 4; ++i) {
+                int digit = hex_value(p[i]);
+                if (digit < 0) {
+                    return false;
+                }
+                value = value * 16 + static_cast<uint32_t>(digit);
+            }
+            p += 4;
+            return true;
+        }
+
+        static void append_utf8(string& out, uint32_t codePoint) {
+            if (codePoint < 0x80) {
+                out += static_cast<char>(codePoint);
+            }
+            else if (codePoint < 0x800) {
+                out += static_cast<char>(0xC0 | (codePoint >> 6));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+            else if (codePoint < 0x10000) {
+                out += static_cast<char>(0xE0 | (codePoint >> 12));
+                out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+            else {
+                out += static_cast<char>(0xF0 | (codePoint >> 18));
+                out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+        }
 
-// Feature class for nutritional information
-class NutritionFeature {
-public:
-    virtual void display_nutritional_info() const = 0;
-};
+        // A string without escapes is returned as a view of the input; one
+        // with escapes is decoded into the chunk's buffer
+        bool parse_string(string_view& result) {
+            if (!consume('"')) {
+                return false;
+            }
+            const char* start = p;
+            p = find_quote_or_escape(p, end);
+            if (p == end) {
+                return false;
+            }
+            if (*p == '"') {
+                result = string_view(start, p - start);
+                ++p;
+                return true;
+            }
 
-// Derived class for Main Course recipes
-class MainCourseRecipe : public Recipe, public NutritionFeature {
-public:
-    // Additional attribute for Main Course recipes
-    string cuisine;
+            string text(start, p - start);
+            while (true) {
+                if (p == end) {
+                    return false;
+                }
+                if (*p == '"') {
+                    ++p;
+                    break;
+                }
+                if (*p != '\\') {
+                    const char* next = find_quote_or_escape(p, end);
+                    text.append(p, next - p);
+                    p = next;
+                    continue;
+                }
 
-    // Default constructor
-    MainCourseRecipe() : cuisine("") {}
+                if (++p == end) {
+                    return false;
+                }
+                char escaped = *p++;
+                switch (escaped) {
+                case '"':
+                case '\\':
+                case '/':
+                    text += escaped;
+                    break;
+                case 'b':
+                    text += '\b';
+                    break;
+                case 'f':
+                    text += '\f';
+                    break;
+                case 'n':
+                    text += '\n';
+                    break;
+                case 'r':
+                    text += '\r';
+                    break;
+                case 't':
+                    text += '\t';
+                    break;
+                case 'u': {
+                    uint32_t codePoint;
+                    if (!parse_hex4(codePoint)) {
+                        return false;
+                    }
+                    // A high surrogate must be followed by its low half
+                    if (codePoint >= 0xD800 && codePoint < 0xDC00) {
+                        uint32_t low;
+                        if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+                            return false;
+                        }
+                        p += 2;
+                        if (!parse_hex4(low) || low < 0xDC00 || low >= 0xE000) {
+                            return false;
+                        }
+                        codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(text, codePoint);
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
 
-    // Constructor with parameters
-    MainCourseRecipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, const string& c)
-        : Recipe(n, ing, st, time), cuisine(c) {}
+            result = chunk.keep(text);
+            return true;
+        }
 
-    
+        // A JSON number, truncated to an int
+        bool parse_int(int& result) {
+            skip_whitespace();
+            bool negative = false;
+            if (p < end && *p == '-') {
+                negative = true;
+                ++p;
+            }
+            if (p == end || *p < '0' || *p > '9') {
+                return false;
+            }
+            long long value = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                value = min(value * 10 + (*p - '0'), static_cast<long long>(INT_MAX));
+                ++p;
+            }
+            // Drop any fraction or exponent
+            while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-')) {
+                ++p;
+            }
+            result = static_cast<int>(negative ? -value : value);
+            return true;
+        }
 
-    // Setters
-   
-    void set_cuisine(const string& c) override {
-        cuisine = c;
-    }
+        bool parse_string_array(uint32_t& first, uint32_t& count) {
+            first = static_cast<uint32_t>(chunk.texts.size());
+            count = 0;
+            if (!consume('[')) {
+                return false;
+            }
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                string_view text;
+                if (!parse_string(text)) {
+                    return false;
+                }
+                chunk.texts.push_back(text);
+                ++count;
+            } while (consume(','));
+            return consume(']');
+        }
 
-    // Override the virtual function to get cuisine
-    string get_cuisine() const override {
-        return cuisine;
-    }
+        // Skip a value of any type, for keys that are not recipe fields
+        bool skip_value() {
+            skip_whitespace();
+            if (p == end) {
+                return false;
+            }
+            if (*p == '"') {
+                string_view ignored;
+                return parse_string(ignored);
+            }
+            if (*p == '[' || *p == '{') {
+                size_t depth = 0;
+                while (p < end) {
+                    char c = *p;
+                    if (c == '"') {
+                        string_view ignored;
+                        if (!parse_string(ignored)) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    ++p;
+                    if (c == '[' || c == '{') {
+                        ++depth;
+                    }
+                    else if ((c == ']' || c == '}') && --depth == 0) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            // Number, true, false or null
+            const char* start = p;
+            while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+                ++p;
+            }
+            return p != start;
+        }
 
-    // Display function
-    void display() const override {
-        Recipe::display();
-        cout << "Cuisine: " << cuisine << "\n";
-    }
+    public:
+        Parser(const char* first, const char* last, ImportChunk& target) : p(first), end(last), chunk(target) {}
 
-    // Function to display nutritional information for Main Course recipes
-    void display_nutritional_info() const override {
-        // Add code to display nutritional information for Main Course recipes
-        cout << "Nutritional information for Main Course: ...\n";
-    }
-};
+        bool parse_record(ImportedRecipe& record) {
+            record = ImportedRecipe{ string_view(), string_view(), RecipeKind::Plain, 0, 0, 0, 0, 0 };
+            bool hasName = false;
+            if (!consume('{')) {
+                return false;
+            }
+            if (!consume('}')) {
+                do {
+                    string_view key;
+                    if (!parse_string(key) || !consume(':')) {
+                        return false;
+                    }
 
-// Feature class for meal planning
-class MealPlanningFeature {
-public:
-    virtual void generate_meal_plan() const = 0;
-};
+                    bool parsed;
+                    if (key == "name") {
+                        parsed = parse_string(record.name);
+                        hasName = true;
+                    }
+                    else if (key == "ingredients") {
+                        parsed = parse_string_array(record.firstIngredient, record.ingredientCount);
+                    }
+                    else if (key == "steps") {
+                        parsed = parse_string_array(record.firstStep, record.stepCount);
+                    }
+                    else if (key == "cookingTime") {
+                        parsed = parse_int(record.cookingTime);
+                    }
+                    else if (key == "cuisine") {
+                        parsed = parse_string(record.category);
+                        record.kind = RecipeKind::MainCourse;
+                    }
+                    else if (key == "type") {
+                        parsed = parse_string(record.category);
+                        record.kind = RecipeKind::Dessert;
+                    }
+                    else {
+                        parsed = skip_value();
+                    }
+                    if (!parsed) {
+                        return false;
+                    }
+                } while (consume(','));
 
-// Derived class for Dessert recipes
-class DessertRecipe : public Recipe, public MealPlanningFeature {
-public:
-    // Additional attribute for Dessert recipes
-    string type;
+                if (!consume('}')) {
+                    return false;
+                }
+            }
+            skip_whitespace();
+            return hasName && p == end;
+        }
+    };
 
-    // Default constructor
-    DessertRecipe() : type("") {}
+    size_t blockSize;
+    size_t threadCount;
 
-    // Constructor with parameters
-    DessertRecipe(const string& n, const vector<string>& ing, const vector<string>& st, int time, const string& t)
-        : Recipe(n, ing, st, time), type(t) {}
+    // Parse the complete lines in [first, last) into chunk
+    static void parse_lines(const char* first, const char* last, ImportChunk& chunk) {
+        while (first < last) {
+            const char* lineEnd = static_cast<const char*>(memchr(first, '\n', last - first));
+            if (lineEnd == nullptr) {
+                lineEnd = last;
+            }
+            ++chunk.lines;
 
-    // Setters
-    void set_type(const string& t) {
-        type = t;
+            // Blank lines are allowed between records
+            const char* p = first;
+            while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+                ++p;
+            }
+            if (p < lineEnd) {
+                size_t textCount = chunk.texts.size();
+                ImportedRecipe record;
+                if (Parser(p, lineEnd, chunk).parse_record(record)) {
+                    chunk.recipes.push_back(record);
+                }
+                else {
+                    chunk.texts.resize(textCount);
+                    chunk.reject();
+                }
+            }
+            first = lineEnd + 1;
+        }
     }
 
-    // Getters
-    string get_type() const {
-        return type;
+    // Parse the lines in [first, last) across the threads, then add the
+    // recipes to the book in input order
+    void import_block(const char* first, const char* last, RecipeBook& book, ImportStats& stats, size_t& linesBefore) {
+        auto lineAfter = [last](const char*, const char* cut) {
+            const char* lineEnd = static_cast<const char*>(memchr(cut, '\n', last - cut));
+            return lineEnd != nullptr ? lineEnd + 1 : last;
+        };
+        deque<ImportChunk> chunks = parse_chunks(split_input(first, last, threadCount, lineAfter), parse_lines);
+        add_imported_recipes(chunks, book, stats, linesBefore);
     }
 
-    // Display function
-    void display() const override {
-        Recipe::display();
-        cout << "Type: " << type << "\n";
+public:
+    // Blocks of about blockBytes are read at a time, and parsed on up to
+    // threads threads (all hardware threads when 0)
+    explicit JsonLinesImporter(size_t blockBytes = 16 * 1024 * 1024, size_t threads = 0)
+        : blockSize(max<size_t>(blockBytes, 4096)), threadCount(threads != 0 ? threads : max(1u, thread::hardware_concurrency())) {}
+
+    ImportStats import_stream(istream& in, RecipeBook& book) {
+        ImportStats stats = { 0, 0, 0 };
+        size_t linesBefore = 0;
+
+        // buffer[0, filled) holds the unprocessed input: the partial last
+        // line of the previous block followed by newly read data
+        vector<char> buffer(blockSize);
+        size_t filled = 0;
+        while (true) {
+            if (filled == buffer.size()) {
+                // A line longer than the buffer; grow until it fits
+                buffer.resize(buffer.size() * 2);
+            }
+            in.read(buffer.data() + filled, buffer.size() - filled);
+            size_t got = static_cast<size_t>(in.gcount());
+            filled += got;
+            bool atEnd = got == 0 || !in;
+
+            // Process through the last complete line, or everything at the end
+            size_t processed = filled;
+            if (!atEnd) {
+                const char* last = buffer.data() + filled;
+                while (last > buffer.data() && last[-1] != '\n') {
+                    --last;
+                }
+                processed = last - buffer.data();
+            }
+            if (processed > 0) {
+                import_block(buffer.data(), buffer.data() + processed, book, stats, linesBefore);
+                copy(buffer.begin() + processed, buffer.begin() + filled, buffer.begin());
+                filled -= processed;
+            }
+            if (atEnd && filled == 0) {
+                break;
+            }
+        }
+        return stats;
     }
 
-    // Function to generate meal plan for Dessert recipes
-    void generate_meal_plan() const override {
-        // Add code to generate meal plan for Dessert recipes
-        cout << "Meal plan for Dessert: ...\n";
+    ImportStats import_file(const string& path, RecipeBook& book) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            return ImportStats{ 0, 0, 0 };
+        }
+        return import_stream(in, book);
     }
 };
 
-// Recipe book class to manage recipes
-class RecipeBook {
+// Splits text at a delimiter into views of it, without copying. Every
+// delimiter ends a token, so "a,,b" gives "a", "", "b" and empty text gives
+// one empty token.
+class Tokenizer {
 private:
-    vector<Recipe*> recipes;
-    map<string, vector<Recipe*>> categoryMap;
+    const char* p;
+    const char* end;
+    char delimiter;
+    bool done;
 
 public:
+    Tokenizer(string_view text, char separator) : p(text.data()), end(text.data() + text.size()), delimiter(separator), done(false) {}
 
-    const vector<Recipe*>& getRecipes() const {
-        return recipes;
+    // Get the next token; false once there are none left
+    bool next(string_view& token) {
+        if (done) {
+            return false;
+        }
+        const char* found = p < end ? static_cast<const char*>(memchr(p, delimiter, end - p)) : nullptr;
+        if (found == nullptr) {
+            token = string_view(p, end - p);
+            done = true;
+            return true;
+        }
+        token = string_view(p, found - p);
+        p = found + 1;
+        return true;
     }
+};
 
-    const map<string, vector<Recipe*>>& getCategoryMap() const {
-        return categoryMap;
+// Text without leading or trailing spaces, tabs and carriage returns
+inline string_view trim_blanks(string_view text) {
+    size_t first = 0;
+    size_t last = text.size();
+    while (first < last && (text[first] == ' ' || text[first] == '\t' || text[first] == '\r')) {
+        ++first;
     }
+    while (last > first && (text[last - 1] == ' ' || text[last - 1] == '\t' || text[last - 1] == '\r')) {
+        --last;
+    }
+    return text.substr(first, last - first);
+}
+
+// Reads recipes from CSV into a RecipeBook. The first row names the columns:
+// name, ingredients, steps, cookingTime, cuisine and type are recognised in
+// any order and case, and other columns are skipped. A cell of ingredients
+// is split at commas and a cell of steps at line ends, as Menu::addRecipe
+// does. A type makes a dessert; otherwise a cuisine makes a main course.
+//
+// The file is mapped and cut into blocks at row ends outside quoted cells.
+// Each block is split the same way across threads, which parse rows into
+// records pointing into the mapping. Recipes are added a block at a time in
+// file order, so the result does not depend on the number of threads.
+class CsvRecipeReader {
+private:
+    enum class Column : uint8_t {
+        Ignored,
+        Name,
+        Ingredients,
+        Steps,
+        CookingTime,
+        Cuisine,
+        Type
+    };
+
+    size_t blockSize;
+    size_t threadCount;
+
+    // Start of the first row after the line end at or after cut. start must
+    // be the start of a row, so quoted cells can be tracked from there.
+    static const char* row_after(const char* start, const char* end, const char* cut) {
+        const char* p = start;
+        while (p < end) {
+            const char* quote = static_cast<const char*>(memchr(p, '"', end - p));
+            const char* from = max(p, cut);
+            if (quote == nullptr || quote >= from) {
+                // Not inside a quoted cell at from
+                const char* stop = quote != nullptr ? quote : end;
+                const char* newline = from < stop ? static_cast<const char*>(memchr(from, '\n', stop - from)) : nullptr;
+                if (newline != nullptr) {
+                    return newline + 1;
+                }
+                if (quote == nullptr) {
+                    return end;
+                }
+            }
 
-    // Add a new recipe
-    void add_recipe(Recipe* newRecipe) {
-        recipes.push_back(newRecipe);
-
-        // Check the type of the recipe and categorize accordingly
-        if (dynamic_cast<MainCourseRecipe*>(newRecipe) != nullptr) {
-            MainCourseRecipe* mainCourseRecipe = dynamic_cast<MainCourseRecipe*>(newRecipe);
-            categoryMap[mainCourseRecipe->get_cuisine()].push_back(mainCourseRecipe);
-        }
-        else if (dynamic_cast<DessertRecipe*>(newRecipe) != nullptr) {
-            DessertRecipe* dessertRecipe = dynamic_cast<DessertRecipe*>(newRecipe);
-            categoryMap[dessertRecipe->get_type()].push_back(dessertRecipe);
+            // Skip the quoted cell; a doubled quote closes and reopens it
+            const char* close = static_cast<const char*>(memchr(quote + 1, '"', end - quote - 1));
+            if (close == nullptr) {
+                return end;
+            }
+            p = close + 1;
         }
-
-        categoryMap["All"].push_back(newRecipe);
+        return end;
     }
 
-    // Display all recipes
-    void display_all_recipes() const {
-        cout << "All Recipes:\n";
-        for (const auto& recipe : recipes) {
-            recipe->display();
-            cout << "-----------------\n";
+    // Split the row [p, end), without its line end, into cells. Quoted
+    // cells with doubled quotes are unescaped into the chunk.
+    static bool split_row(const char* p, const char* end, ImportChunk& chunk, vector<string_view>& cells) {
+        cells.clear();
+        while (true) {
+            if (p < end && *p == '"') {
+                const char* start = ++p;
+                bool escaped = false;
+                while (true) {
+                    p = static_cast<const char*>(memchr(p, '"', end - p));
+                    if (p == nullptr) {
+                        return false;
+                    }
+                    if (p + 1 < end && p[1] == '"') {
+                        escaped = true;
+                        p += 2;
+                        continue;
+                    }
+                    break;
+                }
+                string_view cell(start, p - start);
+                ++p;
+                if (escaped) {
+                    string text;
+                    text.reserve(cell.size());
+                    for (size_t i = 0; i < cell.size(); ++i) {
+                        text += cell[i];
+                        if (cell[i] == '"') {
+                            ++i;
+                        }
+                    }
+                    cell = chunk.keep(text);
+                }
+                cells.push_back(cell);
+                if (p == end) {
+                    return true;
+                }
+                if (*p != ',') {
+                    return false;
+                }
+                ++p;
+            }
+            else {
+                const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+                if (comma == nullptr) {
+                    cells.emplace_back(p, end - p);
+                    return true;
+                }
+                cells.emplace_back(p, comma - p);
+                p = comma + 1;
+            }
         }
     }
 
-    // Display recipes based on a specific category
-    void display_recipes_by_category(const string& category) const {
-        if (categoryMap.find(category) != categoryMap.end()) {
-            cout << "Recipes in Category '" << category << "':\n";
-            for (const auto& recipe : categoryMap.at(category)) {
-                recipe->display();
-                cout << "-----------------\n";
+    // Add the non-empty items of a list cell to the chunk's texts
+    static uint32_t add_items(string_view cell, char separator, ImportChunk& chunk) {
+        uint32_t count = 0;
+        string_view item;
+        for (Tokenizer items(cell, separator); items.next(item);) {
+            item = trim_blanks(item);
+            if (!item.empty()) {
+                chunk.texts.push_back(item);
+                ++count;
             }
         }
-        else {
-            cout << "Category not found.\n";
-        }
+        return count;
     }
 
-    // Search for recipes based on ingredients
-    vector<Recipe*> search_recipes_by_ingredient(const string& ingredient) const {
-        vector<Recipe*> result;
-        for (const auto& recipe : recipes) {
-            if (find(recipe->get_ingredients().begin(), recipe->get_ingredients().end(), ingredient) != recipe->get_ingredients().end()) {
-                result.push_back(recipe);
+    // Whole minutes; an empty cell counts as 0
+    static bool parse_minutes(string_view cell, int& minutes) {
+        cell = trim_blanks(cell);
+        bool negative = !cell.empty() && cell[0] == '-';
+        if (negative) {
+            cell.remove_prefix(1);
+        }
+        long long value = 0;
+        for (char c : cell) {
+            if (c < '0' || c > '9') {
+                return false;
             }
+            value = min(value * 10 + (c - '0'), static_cast<long long>(INT_MAX));
         }
-        return result;
+        minutes = static_cast<int>(negative ? -value : value);
+        return true;
     }
 
+    static bool parse_recipe(const vector<Column>& columns, const vector<string_view>& cells, ImportChunk& chunk, ImportedRecipe& recipe) {
+        recipe = ImportedRecipe{ string_view(), string_view(), RecipeKind::Plain, 0, 0, 0, 0, 0 };
+        string_view cuisine;
+        string_view type;
+        for (size_t i = 0; i < cells.size() && i < columns.size(); ++i) {
+            switch (columns[i]) {
+            case Column::Name:
+                recipe.name = cells[i];
+                break;
+            case Column::Ingredients:
+                recipe.firstIngredient = static_cast<uint32_t>(chunk.texts.size());
+                recipe.ingredientCount = add_items(cells[i], ',', chunk);
+                break;
+            case Column::Steps:
+                recipe.firstStep = static_cast<uint32_t>(chunk.texts.size());
+                recipe.stepCount = add_items(cells[i], '\n', chunk);
+                break;
+            case Column::CookingTime:
+                if (!parse_minutes(cells[i], recipe.cookingTime)) {
+                    return false;
+                }
+                break;
+            case Column::Cuisine:
+                cuisine = trim_blanks(cells[i]);
+                break;
+            case Column::Type:
+                type = trim_blanks(cells[i]);
+                break;
+            default:
+                break;
+            }
+        }
 
+        if (!type.empty()) {
+            recipe.kind = RecipeKind::Dessert;
+            recipe.category = type;
+        }
+        else if (!cuisine.empty()) {
+            recipe.kind = RecipeKind::MainCourse;
+            recipe.category = cuisine;
+        }
+        return !recipe.name.empty();
+    }
 
-    // Delete a recipe
-    void delete_recipe(Recipe* recipeToDelete) {
-        auto it = find(recipes.begin(), recipes.end(), recipeToDelete);
-        if (it != recipes.end()) {
-            // Remove from categories first
-            for (auto& categoryPair : categoryMap) {
-                auto& categoryRecipes = categoryPair.second;
-                auto catIt = find(categoryRecipes.begin(), categoryRecipes.end(), recipeToDelete);
-                if (catIt != categoryRecipes.end()) {
-                    categoryRecipes.erase(catIt);
+    // Parse the rows in [first, last) into chunk
+    static void parse_rows(const vector<Column>& columns, const char* first, const char* last, ImportChunk& chunk) {
+        vector<string_view> cells;
+        while (first < last) {
+            const char* next = row_after(first, last, first);
+            const char* rowEnd = next;
+            if (rowEnd > first && rowEnd[-1] == '\n') {
+                --rowEnd;
+            }
+            if (rowEnd > first && rowEnd[-1] == '\r') {
+                --rowEnd;
+            }
+            ++chunk.lines;
+
+            // Blank rows are skipped
+            if (rowEnd > first) {
+                size_t textCount = chunk.texts.size();
+                ImportedRecipe recipe;
+                if (split_row(first, rowEnd, chunk, cells) && parse_recipe(columns, cells, chunk, recipe)) {
+                    chunk.recipes.push_back(recipe);
                 }
+                else {
+                    chunk.texts.resize(textCount);
+                    chunk.reject();
+                }
+            }
+            first = next;
+        }
+    }
+
+    static Column column_named(string_view name) {
+        static const pair<string_view, Column> known[] = {
+            { "name", Column::Name },
+            { "ingredients", Column::Ingredients },
+            { "steps", Column::Steps },
+            { "cookingtime", Column::CookingTime },
+            { "cuisine", Column::Cuisine },
+            { "type", Column::Type }
+        };
+        name = trim_blanks(name);
+        for (const auto& entry : known) {
+            if (entry.first.size() == name.size() && equal(name.begin(), name.end(), entry.first.begin(), [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == b; })) {
+                return entry.second;
             }
+        }
+        return Column::Ignored;
+    }
 
-            // Delete the recipe
-            delete* it;
-            recipes.erase(it);
+public:
+    // Blocks of about blockBytes are parsed at a time, on up to threads
+    // threads (all hardware threads when 0)
+    explicit CsvRecipeReader(size_t blockBytes = 16 * 1024 * 1024, size_t threads = 0)
+        : blockSize(max<size_t>(blockBytes, 4096)), threadCount(threads != 0 ? threads : max(1u, thread::hardware_concurrency())) {}
+
+    // Read the CSV in text. A header without a name column rejects row 1
+    // and reads nothing.
+    ImportStats read_text(string_view text, RecipeBook& book) const {
+        ImportStats stats = { 0, 0, 0 };
+        // Spreadsheets often start UTF-8 files with a byte order mark
+        if (text.substr(0, 3) == "\xEF\xBB\xBF") {
+            text.remove_prefix(3);
+        }
+        if (text.empty()) {
+            return stats;
+        }
+        const char* first = text.data();
+        const char* last = text.data() + text.size();
 
-            cout << "Recipe deleted successfully.\n";
+        const char* body = row_after(first, last, first);
+        const char* headerEnd = body;
+        while (headerEnd > first && (headerEnd[-1] == '\n' || headerEnd[-1] == '\r')) {
+            --headerEnd;
         }
-        else {
-            cout << "Recipe not found.\n";
+        ImportChunk header;
+        vector<string_view> names;
+        vector<Column> columns;
+        if (split_row(first, headerEnd, header, names)) {
+            for (string_view name : names) {
+                columns.push_back(column_named(name));
+            }
+        }
+        if (find(columns.begin(), columns.end(), Column::Name) == columns.end()) {
+            stats.rejected = 1;
+            stats.firstRejectedLine = 1;
+            return stats;
+        }
+
+        size_t linesBefore = 1;
+        auto parse = [&columns](const char* from, const char* to, ImportChunk& chunk) {
+            parse_rows(columns, from, to, chunk);
+        };
+        while (body < last) {
+            const char* blockEnd = static_cast<size_t>(last - body) <= blockSize ? last : row_after(body, last, body + blockSize);
+            auto rowAfter = [blockEnd](const char* start, const char* cut) {
+                return row_after(start, blockEnd, cut);
+            };
+            deque<ImportChunk> chunks = parse_chunks(split_input(body, blockEnd, threadCount, rowAfter), parse);
+            add_imported_recipes(chunks, book, stats, linesBefore);
+            body = blockEnd;
         }
+        return stats;
     }
 
-    void delete_recipe(size_t index) {
-        // Ensure the index is within bounds
-        if (index < recipes.size()) {
-            // Use erase to remove the recipe at the specified index
-            recipes.erase(recipes.begin() + index);
+    ImportStats read_file(const string& path, RecipeBook& book) const {
+        MappedFile file;
+        if (!file.open(path)) {
+            return ImportStats{ 0, 0, 0 };
         }
+        return read_text(string_view(file.data(), file.size()), book);
     }
+};
 
-    void display_all_categories() const {
-        cout << "Categories:\n";
-        int count = 1;
-        for (const auto& categoryPair : categoryMap) {
-            cout << count << ". " << categoryPair.first << "\n";
-            ++count;
+// Writes a RecipeBook as CSV that CsvRecipeReader reads back: a header row,
+// then one row per recipe in book order. Cells holding commas, quotes or
+// line ends are quoted. Ingredients are joined with commas and steps with
+// line ends, so ones containing those, or starting or ending in blanks that
+// the reader trims, do not survive the round trip.
+class CsvRecipeWriter {
+private:
+    static void append_cell(string& out, string_view cell) {
+        if (cell.find_first_of(",\"\r\n") == string_view::npos) {
+            out.append(cell.data(), cell.size());
+            return;
+        }
+        out += '"';
+        for (char c : cell) {
+            if (c == '"') {
+                out += '"';
+            }
+            out += c;
         }
+        out += '"';
     }
 
-};
+public:
+    static void write(ostream& out, const RecipeBook& book) {
+        const IngredientTable& table = IngredientTable::instance();
+        const size_t flushSize = 1024 * 1024;
+        string buffer = "name,ingredients,steps,cookingTime,cuisine,type\n";
+        string list;
+        for (const Recipe* header : book.getRecipes()) {
+            shared_ptr<const Recipe> recipe = book.full_recipe(header);
+            append_cell(buffer, recipe->name_view());
+            buffer += ',';
+
+            list.clear();
+            ArrayView<IngredientId> ingredients = recipe->ingredient_ids_view();
+            for (size_t i = 0; i < ingredients.size(); ++i) {
+                if (i != 0) {
+                    list += ',';
+                }
+                list += table.name_view(ingredients[i]);
+            }
+            append_cell(buffer, list);
+            buffer += ',';
+
+            list.clear();
+            ArrayView<pmr::string> steps = recipe->steps_view();
+            for (size_t i = 0; i < steps.size(); ++i) {
+                if (i != 0) {
+                    list += '\n';
+                }
+                list += steps[i];
+            }
+            append_cell(buffer, list);
+            buffer += ',';
+            buffer += to_string(recipe->get_cooking_time());
+
+            // The category goes under cuisine or type by the kind of recipe
+            buffer += ',';
+            if (recipe->get_kind() == RecipeKind::MainCourse) {
+                append_cell(buffer, recipe_category(*recipe));
+            }
+            buffer += ',';
+            if (recipe->get_kind() == RecipeKind::Dessert) {
+                append_cell(buffer, recipe_category(*recipe));
+            }
+            buffer += '\n';
 
+            if (buffer.size() >= flushSize) {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+    }
 
+    static bool write_file(const string& path, const RecipeBook& book) {
+        ofstream out(path, ios::binary);
+        if (!out) {
+            return false;
+        }
+        write(out, book);
+        return static_cast<bool>(out);
+    }
+};
 
 class Menu {
 public:
-    Menu(sf::RenderWindow& window) : window(window) {}
+    // With checkpoints, each addition or deletion is saved in the
+    // background as soon as it is made
+    Menu(sf::RenderWindow& window, CheckpointStore* checkpoints = nullptr) : window(window), checkpoints(checkpoints) {}
 
     int showMenu(RecipeBook& recipeBook) {
         int choice = -1;
@@ -396,7 +7544,7 @@ public:
             static size_t currentRecipeIndex = 0; // Keep track of the current recipe index
 
             // Display recipe details using SFML text
-            recipeText.setString(recipes[currentRecipeIndex]->get_recipe());
+            recipeText.setString(recipeBook.full_recipe(recipes[currentRecipeIndex])->get_recipe());
             recipeText.setPosition(10, 10); // Set the position for recipe details
             window.draw(recipeText);
 
@@ -431,7 +7579,7 @@ public:
                         }
 
                         // Update displayed recipe details
-                        recipeText.setString(recipes[currentRecipeIndex]->get_recipe());
+                        recipeText.setString(recipeBook.full_recipe(recipes[currentRecipeIndex])->get_recipe());
                         recipeText.setPosition(10, 10); // Adjust position based on your layout
                         window.clear(sf::Color(25, 149, 230));  // Clear the window before redrawing
                         window.draw(recipeText);
@@ -463,7 +7611,7 @@ public:
         }
     }
 
-    void displayRecipesByCategory(const RecipeBook& recipeBook) {
+    void displayRecipesByCategory(RecipeBook& recipeBook) {
         window.clear(sf::Color(25, 149, 230));
 
         // Assuming you have a font loaded for text rendering
@@ -478,15 +7626,13 @@ public:
         categoryText.setCharacterSize(18);
         categoryText.setFillColor(sf::Color::White);
 
-        // Display all categories
-        const map<string, vector<Recipe*>>& categories = recipeBook.getCategoryMap();
+        // Display all categories, starting with the virtual "All" category
+        const CategoryIndex& categories = recipeBook.getCategories();
 
-        if (!categories.empty()) {
-            string categoryOptions = "Categories:\n";
-            int count = 1;
-            for (const auto& categoryPair : categories) {
-                categoryOptions += to_string(count) + ". " + categoryPair.first + "\n";
-                ++count;
+        if (!recipeBook.getRecipes().empty()) {
+            string categoryOptions = "Categories:\n1. All\n";
+            for (CategoryId id = 0; id < categories.size(); ++id) {
+                categoryOptions += to_string(id + 2) + ". " + categories.name(id) + "\n";
             }
 
             categoryText.setString(categoryOptions);
@@ -545,7 +7691,7 @@ public:
         }
     }
 
-    void displayRecipesForSelectedCategory(RecipeBook recipeBook, int selectedCategory) {
+    void displayRecipesForSelectedCategory(RecipeBook& recipeBook, int selectedCategory) {
         window.clear(sf::Color(25, 149, 230));
 
         // Assuming you have a font loaded for text rendering
@@ -569,25 +7715,23 @@ public:
 
         window.draw(text1);
 
-        // Display recipes for the selected category
-        const map<string, vector<Recipe*>>& categories = recipeBook.getCategoryMap();
-
-        int count = 1;
-        auto it = categories.begin();
-        while (it != categories.end() && count < selectedCategory) {
-            ++it;
-            ++count;
-        }
+        // Display recipes for the selected category; option 1 is "All" and
+        // option n + 2 is category ID n
+        const CategoryIndex& categories = recipeBook.getCategories();
 
-        if (it != categories.end()) {
-            string categoryName = it->first;
-            const vector<Recipe*>& categoryRecipes = it->second;
+        if (selectedCategory >= 1 && static_cast<size_t>(selectedCategory - 1) <= categories.size()) {
+            CategoryId categoryId = selectedCategory == 1 ? CategoryIndex::all : static_cast<CategoryId>(selectedCategory - 2);
+            string categoryName = selectedCategory == 1 ? "All" : categories.name(categoryId);
+            size_t recipeCount = recipeBook.category_size(categoryId);
 
-            if (!categoryRecipes.empty()) {
+            if (recipeCount != 0) {
                 static size_t currentRecipeIndex = 0; // Keep track of the current recipe index
+                if (currentRecipeIndex >= recipeCount) {
+                    currentRecipeIndex = 0;
+                }
 
                 // Display recipe details using SFML text
-                recipeText.setString(categoryRecipes[currentRecipeIndex]->get_recipe());
+                recipeText.setString(recipeBook.full_recipe(recipeBook.category_recipe(categoryId, currentRecipeIndex))->get_recipe());
                 recipeText.setPosition(10, 10); // Set the position for recipe details
                 window.draw(recipeText);
 
@@ -608,18 +7752,18 @@ public:
                                 break;
                             case sf::Keyboard::Right:
                                 // Navigate to the next recipe
-                                currentRecipeIndex = (currentRecipeIndex + 1) % categoryRecipes.size();
+                                currentRecipeIndex = (currentRecipeIndex + 1) % recipeCount;
                                 break;
                             case sf::Keyboard::Left:
                                 // Navigate to the previous recipe
-                                currentRecipeIndex = (currentRecipeIndex == 0) ? categoryRecipes.size() - 1 : currentRecipeIndex - 1;
+                                currentRecipeIndex = (currentRecipeIndex == 0) ? recipeCount - 1 : currentRecipeIndex - 1;
                                 break;
                             default:
                                 break;
                             }
 
                             // Update displayed recipe details
-                            recipeText.setString(categoryRecipes[currentRecipeIndex]->get_recipe());
+                            recipeText.setString(recipeBook.full_recipe(recipeBook.category_recipe(categoryId, currentRecipeIndex))->get_recipe());
                             recipeText.setPosition(10, 10); // Adjust position based on your layout
                             window.clear(sf::Color(25, 149, 230)); // Clear the window before redrawing
                             window.draw(recipeText);
@@ -749,27 +7893,27 @@ public:
         }
 
    
-        // Tokenize ingredients and steps manually
+        // Split ingredients at commas and steps at line ends
         vector<string> ingredientTokens;
-        size_t pos = 0;
-        while ((pos = ingredients.find(',')) != string::npos) {
-            ingredientTokens.push_back(ingredients.substr(0, pos));
-            ingredients.erase(0, pos + 1);
-        }
-        ingredientTokens.push_back(ingredients);
-
         vector<string> stepTokens;
-        pos = 0;
-        while ((pos = steps.find('\n')) != string::npos) {
-            stepTokens.push_back(steps.substr(0, pos));
-            steps.erase(0, pos + 1);
+        string_view token;
+        for (Tokenizer tokens(ingredients, ','); tokens.next(token);) {
+            ingredientTokens.emplace_back(token);
+        }
+        for (Tokenizer tokens(steps, '\n'); tokens.next(token);) {
+            stepTokens.emplace_back(token);
         }
-        stepTokens.push_back(steps);
 
-        // Create a new recipe and add it to the recipe book
-        Recipe* newRecipe = new Recipe(name, ingredientTokens, stepTokens, cookingTime);
-        newRecipe->set_cuisine(cuisine);
-        recipeBook.add_recipe(newRecipe);
+        // Create a new recipe and add it to the recipe book, filed under
+        // its cuisine if one was given
+        if (cuisine.empty()) {
+            recipeBook.emplace_recipe<Recipe>(name, ingredientTokens, stepTokens, cookingTime);
+        }
+        else {
+            recipeBook.emplace_recipe<MainCourseRecipe>(name, ingredientTokens, stepTokens, cookingTime, cuisine);
+        }
+        // Save now: the menu below runs nested and only returns on exit
+        saveChanges(recipeBook);
 
         sf::Text text1;
         text1.setFont(font);
@@ -813,14 +7957,19 @@ public:
         promptText.setPosition(10, 10);
 
         // Display recipe names
-        vector<Recipe*> recipes = recipeBook.getRecipes();
+        const vector<Recipe*>& recipes = recipeBook.getRecipes();
         sf::Text recipeListText("", font, 20);
         recipeListText.setPosition(10, 50);
 
         // Populate recipeListText with recipe names
+        string recipeList;
         for (size_t i = 0; i < recipes.size(); ++i) {
-            recipeListText.setString(recipeListText.getString() + std::to_string(i + 1) + ". " + recipes[i]->get_name() + "\n");
+            recipeList += to_string(i + 1);
+            recipeList += ". ";
+            recipeList += recipes[i]->name_view();
+            recipeList += "\n";
         }
+        recipeListText.setString(recipeList);
 
         window.draw(promptText);
         window.draw(recipeListText);
@@ -851,6 +8000,7 @@ public:
             if (selectedRecipe >= 0 && static_cast<size_t>(selectedRecipe) < recipes.size()) {
                 // Delete the selected recipe
                 recipeBook.delete_recipe(static_cast<size_t>(selectedRecipe));
+                saveChanges(recipeBook);
 
                 // Display "Recipe Deleted \n Press esc to Return"
                 sf::Text deletedText("Recipe Deleted \n Press esc to Return", font, 30);
@@ -922,34 +8072,62 @@ private:
         }
     }
 
+    void saveChanges(RecipeBook& recipeBook) {
+        if (checkpoints != nullptr) {
+            checkpoints->checkpoint_async(recipeBook);
+        }
+    }
+
 
     sf::RenderWindow& window;
+    CheckpointStore* checkpoints;
 };
 
 int main() {
    
 
-    // Create a RecipeBook
-    RecipeBook recipeBook;
+    // Create a RecipeBook whose recipes share one arena
+    RecipeBook recipeBook(64 * 1024);
+
+    // Pick up the book saved by the last run, or start from the default recipes
+    const string imagePath = "recipes.rbk";
+    const string logPath = "recipes.log";
+    CheckpointStore checkpoints(imagePath);
+    if (!checkpoints.recover(recipeBook)) {
+        // Add default recipes
+        recipeBook.emplace_recipe<MainCourseRecipe>("Spaghetti Carbonara", { "Spaghetti", "Guanciale", "Pecorino Cheese", "Eggs", "Black Pepper" }, { "Boil spaghetti", "Cook guanciale", "Mix with eggs and cheese", "Add black pepper" }, 25, "Italian");
+        recipeBook.emplace_recipe<MainCourseRecipe>("Chicken Alfredo", { "Fettuccine", "Chicken Breast", "Heavy Cream", "Parmesan Cheese", "Garlic" }, { "Cook fettuccine", "Saut� chicken", "Mix with cream and cheese", "Add garlic" }, 30, "Italian");
 
-    // Add default recipes
-    MainCourseRecipe* defaultMainCourse1 = new MainCourseRecipe("Spaghetti Carbonara", { "Spaghetti", "Guanciale", "Pecorino Cheese", "Eggs", "Black Pepper" }, { "Boil spaghetti", "Cook guanciale", "Mix with eggs and cheese", "Add black pepper" }, 25, "Italian");
-    MainCourseRecipe* defaultMainCourse2 = new MainCourseRecipe("Chicken Alfredo", { "Fettuccine", "Chicken Breast", "Heavy Cream", "Parmesan Cheese", "Garlic" }, { "Cook fettuccine", "Saut chicken", "Mix with cream and cheese", "Add garlic" }, 30, "Italian");
+        recipeBook.emplace_recipe<DessertRecipe>("Classic Chocolate Cake", { "Flour", "Sugar", "Cocoa Powder", "Baking Powder", "Butter", "Eggs", "Milk", "Vanilla Extract" }, { "Mix dry ingredients", "Cream butter and sugar", "Add eggs and vanilla", "Alternate adding dry ingredients and milk", "Bake in the oven" }, 40, "Cake");
+        recipeBook.emplace_recipe<DessertRecipe>("Strawberry Cheesecake", { "Graham Cracker Crust", "Cream Cheese", "Sugar", "Eggs", "Vanilla Extract", "Strawberries" }, { "Prepare crust", "Mix cream cheese, sugar, eggs, and vanilla", "Pour over crust", "Top with strawberries", "Chill in the fridge" }, 45, "Cheesecake");
+    }
 
-    DessertRecipe* defaultDessert1 = new DessertRecipe("Classic Chocolate Cake", { "Flour", "Sugar", "Cocoa Powder", "Baking Powder", "Butter", "Eggs", "Milk", "Vanilla Extract" }, { "Mix dry ingredients", "Cream butter and sugar", "Add eggs and vanilla", "Alternate adding dry ingredients and milk", "Bake in the oven" }, 40, "Cake");
-    DessertRecipe* defaultDessert2 = new DessertRecipe("Strawberry Cheesecake", { "Graham Cracker Crust", "Cream Cheese", "Sugar", "Eggs", "Vanilla Extract", "Strawberries" }, { "Prepare crust", "Mix cream cheese, sugar, eggs, and vanilla", "Pour over crust", "Top with strawberries", "Chill in the fridge" }, 45, "Cheesecake");
+    // Redo edits that a crash kept out of the image, then log new ones
+    OperationLog log;
+    if (log.open(logPath)) {
+        recipeBook.replay_log(log);
+        recipeBook.attach_log(&log);
+    }
 
-    recipeBook.add_recipe(defaultMainCourse1);
-    recipeBook.add_recipe(defaultMainCourse2);
-    recipeBook.add_recipe(defaultDessert1);
-    recipeBook.add_recipe(defaultDessert2);
+    // Fold accumulated deltas into the base image while the menu runs
+    checkpoints.merge(8);
 
 
     sf::RenderWindow window(sf::VideoMode(800, 600), "SFML Recipe Book Menu");
-    Menu menu(window);
+    Menu menu(window, &checkpoints);
 
     int choice = menu.showMenu(recipeBook);
 
+    // Checkpoint whatever the menu has not saved yet and wait for the
+    // background saves to finish. flush() is true only once every image
+    // and the directory naming it are synced; only then can the log start
+    // over, otherwise it stays to be replayed on the next start.
+    checkpoints.checkpoint_async(recipeBook);
+    if (checkpoints.flush()) {
+        log.reset();
+    }
+    recipeBook.attach_log(nullptr);
+
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,301 @@
+// Crash-recovery checks for the checkpoint images, their deltas and the
+// operation log. Each check writes a book, damages what a crash or a bad
+// disk could leave behind, then recovers and compares against what should
+// have survived. Exits non-zero if any check fails.
+
+// Build the app's single source file without its main
+#define main recipe_book_main
+#include "../Recipe Book/Source.cpp"
+#undef main
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* what) {
+    if (!condition) {
+        cout << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Everything recovery has to bring back, in a form that compares directly
+vector<string> contents(const RecipeBook& book) {
+    vector<string> lines;
+    for (const Recipe* recipe : book.getRecipes()) {
+        string line(recipe->name_view());
+        line += "|" + to_string(recipe->get_cooking_time()) + "|" + string(recipe_category(*recipe)) + "|";
+        for (IngredientId id : recipe->ingredient_ids_view()) {
+            line += IngredientTable::instance().name(id) + ",";
+        }
+        for (string_view step : recipe->steps_view()) {
+            line += string(step) + ";";
+        }
+        RecipeHandle handle = recipe->get_handle();
+        line += "@" + to_string(handle.index) + "." + to_string(handle.generation);
+        lines.push_back(line);
+    }
+    sort(lines.begin(), lines.end());
+    return lines;
+}
+
+void add_recipes(RecipeBook& book, const string& prefix, int count) {
+    for (int i = 0; i < count; ++i) {
+        book.emplace_recipe<MainCourseRecipe>(prefix + to_string(i), { "salt", prefix + to_string(i % 5) }, { "mix", "cook" }, i, prefix);
+    }
+}
+
+// A fresh, empty directory for one check, and the base image path in it
+string fresh_base(const string& name) {
+    filesystem::path directory = filesystem::temp_directory_path() / ("recipe-book-" + name);
+    filesystem::remove_all(directory);
+    filesystem::create_directories(directory);
+    return (directory / "book.rbk").string();
+}
+
+void flip_byte(const string& path, uint64_t offset) {
+    fstream file(path, ios::binary | ios::in | ios::out);
+    file.seekg(static_cast<streamoff>(offset));
+    char byte = 0;
+    file.read(&byte, 1);
+    file.seekp(static_cast<streamoff>(offset));
+    byte = static_cast<char>(byte ^ 0x10);
+    file.write(&byte, 1);
+}
+
+void truncate_to(const string& path, uint64_t size) {
+    filesystem::resize_file(path, size);
+}
+
+// The delta files beside base, oldest first
+vector<string> delta_files(const string& base) {
+    vector<string> paths;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(filesystem::path(base).parent_path())) {
+        if (entry.path().extension() == ".delta") {
+            paths.push_back(entry.path().string());
+        }
+    }
+    sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// A base and its deltas come back as the book that saved them
+void test_base_and_deltas() {
+    string base = fresh_base("deltas");
+    RecipeBook book(4096);
+    CheckpointStore store(base);
+    add_recipes(book, "a", 40);
+    check(store.checkpoint(book), "full checkpoint");
+    for (int round = 0; round < 3; ++round) {
+        add_recipes(book, "d" + to_string(round) + "_", 5);
+        book.delete_recipe(book.getRecipes()[round]);
+        check(store.checkpoint(book), "delta checkpoint");
+    }
+    check(store.delta_count() == 3, "three deltas on disk");
+
+    RecipeBook recovered(4096);
+    CheckpointStore reopened(base);
+    check(reopened.recover(recovered), "recover base and deltas");
+    check(contents(recovered) == contents(book), "base and deltas recover the book");
+}
+
+// A base that was torn or flipped fails its checksum and gives way to the
+// previous base; the log then redoes what only the damaged base held
+void test_damaged_base() {
+    string base = fresh_base("damaged");
+    string logPath = base + ".log";
+    vector<string> expected;
+    vector<string> previous;
+    {
+        RecipeBook book(4096);
+        CheckpointStore store(base);
+        OperationLog log;
+        check(log.open(logPath), "open log");
+        book.attach_log(&log);
+        add_recipes(book, "a", 30);
+        check(store.checkpoint(book), "first base");
+        previous = contents(book);
+        add_recipes(book, "b", 10);
+        check(store.checkpoint(book), "delta after first base");
+        store.merge(1);
+        store.wait_for_merge();
+        check(store.delta_count() == 0, "merge absorbed the delta");
+        check(log.flush(), "log on disk");
+        book.attach_log(nullptr);
+        expected = contents(book);
+    }
+
+    // Inside the first section, which only the checksum guards
+    const uint64_t sectionByte = sizeof(RecipeImage::Header) + 4;
+    for (int damage = 0; damage < 2; ++damage) {
+        string saved = base + ".saved";
+        filesystem::copy_file(base, saved, filesystem::copy_options::overwrite_existing);
+        if (damage == 0) {
+            flip_byte(base, sectionByte);
+        }
+        else {
+            truncate_to(base, sectionByte);
+        }
+        RecipeImage image;
+        check(!image.open(base), "damaged base refused");
+
+        RecipeBook fallback(4096);
+        CheckpointStore store(base);
+        check(store.recover(fallback), "recover from previous base");
+        check(contents(fallback) == previous, "previous base recovered");
+        check(fallback.needs_full_checkpoint(), "previous base forces a whole image");
+        OperationLog log;
+        check(log.open(logPath), "reopen log");
+        fallback.replay_log(log);
+        check(contents(fallback) == expected, "log redoes what the damaged base held");
+
+        filesystem::copy_file(saved, base, filesystem::copy_options::overwrite_existing);
+    }
+
+    // With no usable image at all, the log alone rebuilds the book
+    flip_byte(base, sectionByte);
+    filesystem::remove(base + ".prev");
+    RecipeBook empty(4096);
+    CheckpointStore store(base);
+    check(!store.recover(empty), "no usable base");
+    OperationLog log;
+    check(log.open(logPath), "reopen log");
+    empty.replay_log(log);
+    check(contents(empty) == expected, "log alone rebuilds the book");
+}
+
+// A damaged delta ends the chain at the delta before it
+void test_damaged_delta() {
+    string base = fresh_base("delta-damage");
+    RecipeBook book(4096);
+    CheckpointStore store(base);
+    add_recipes(book, "a", 20);
+    check(store.checkpoint(book), "full checkpoint");
+    add_recipes(book, "b", 5);
+    check(store.checkpoint(book), "first delta");
+    vector<string> expected = contents(book);
+    add_recipes(book, "c", 5);
+    check(store.checkpoint(book), "second delta");
+
+    string lastDelta = delta_files(base).back();
+    flip_byte(lastDelta, filesystem::file_size(lastDelta) - 1);
+
+    RecipeBook recovered(4096);
+    CheckpointStore reopened(base);
+    check(reopened.recover(recovered), "recover with a damaged delta");
+    check(contents(recovered) == expected, "chain stops before the damaged delta");
+}
+
+// A break in the middle of the chain sets the deltas after it aside, so the
+// new history written after recovery never has old deltas replayed onto it
+void test_broken_chain() {
+    string base = fresh_base("broken-chain");
+    {
+        RecipeBook book(4096);
+        CheckpointStore store(base);
+        add_recipes(book, "a", 20);
+        check(store.checkpoint(book), "full checkpoint");
+        for (int round = 0; round < 3; ++round) {
+            add_recipes(book, "d" + to_string(round) + "_", 4);
+            book.delete_recipe(book.getRecipes()[round]);
+            check(store.checkpoint(book), "delta checkpoint");
+        }
+    }
+    vector<string> deltas = delta_files(base);
+    check(deltas.size() == 3, "three deltas on disk");
+    flip_byte(deltas[1], filesystem::file_size(deltas[1]) - 1);
+
+    vector<string> expected;
+    {
+        RecipeBook book(4096);
+        CheckpointStore store(base);
+        check(store.recover(book), "recover up to the break");
+        check(book.needs_full_checkpoint(), "break forces a whole image");
+        check(delta_files(base).size() == 1, "deltas after the break set aside");
+        // One save of new history, then a crash before the next; an old
+        // delta numbered after it must not be replayed on top
+        add_recipes(book, "new", 3);
+        book.delete_recipe(book.getRecipes()[0]);
+        store.checkpoint_async(book);
+        check(store.flush(), "new history on disk");
+        expected = contents(book);
+    }
+
+    RecipeBook recovered(4096);
+    CheckpointStore reopened(base);
+    check(reopened.recover(recovered), "recover the new history");
+    check(contents(recovered) == expected, "old deltas not replayed onto the new history");
+    check(!recovered.needs_full_checkpoint(), "unbroken chain needs no whole image");
+}
+
+// A delta a merge absorbed but did not get to delete is skipped
+void test_leftover_delta() {
+    string base = fresh_base("leftover");
+    RecipeBook book(4096);
+    CheckpointStore store(base);
+    add_recipes(book, "a", 20);
+    check(store.checkpoint(book), "full checkpoint");
+    add_recipes(book, "b", 5);
+    check(store.checkpoint(book), "delta");
+
+    string delta;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(filesystem::path(base).parent_path())) {
+        if (entry.path().extension() == ".delta") {
+            delta = entry.path().string();
+        }
+    }
+    filesystem::copy_file(delta, delta + ".keep");
+    store.merge(1);
+    store.wait_for_merge();
+    filesystem::rename(delta + ".keep", delta);
+
+    RecipeBook recovered(4096);
+    CheckpointStore reopened(base);
+    check(reopened.recover(recovered), "recover after an interrupted merge");
+    check(contents(recovered) == contents(book), "leftover delta ignored");
+}
+
+// A record cut short by a crash ends replay; the ones before it are kept
+void test_torn_log() {
+    string base = fresh_base("torn-log");
+    string logPath = base + ".log";
+    vector<string> expected;
+    {
+        RecipeBook book(4096);
+        OperationLog log;
+        check(log.open(logPath), "open log");
+        book.attach_log(&log);
+        add_recipes(book, "a", 10);
+        book.delete_recipe(book.getRecipes()[0]);
+        check(log.flush(), "log on disk");
+        expected = contents(book);
+        add_recipes(book, "torn", 1);
+        check(log.flush(), "last record on disk");
+        book.attach_log(nullptr);
+    }
+    truncate_to(logPath, filesystem::file_size(logPath) - 3);
+
+    RecipeBook recovered(4096);
+    OperationLog log;
+    check(log.open(logPath), "reopen torn log");
+    recovered.replay_log(log);
+    check(contents(recovered) == expected, "replay stops at the torn record");
+}
+
+}
+
+int main() {
+    test_base_and_deltas();
+    test_damaged_base();
+    test_damaged_delta();
+    test_broken_chain();
+    test_leftover_delta();
+    test_torn_log();
+
+    if (failures != 0) {
+        cout << failures << " recovery check(s) failed.\n";
+        return 1;
+    }
+    cout << "All recovery checks passed.\n";
+    return 0;
+}